@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+struct arena_range {
+	uint32_t offset, len;
+	uint64_t frame; /* when retired */
+};
+
+struct arena {
+	uint32_t capacity;
+	uint32_t used;
+
+	/* available ranges, sorted by offset, never adjacent */
+	struct arena_range * free;
+	uint32_t free_len, free_size;
+
+	/* freed ranges waiting for the frames in flight, in frame order */
+	struct arena_range * retired;
+	uint32_t retired_len, retired_size;
+};
+
+static int reserve(struct arena_range ** ranges, uint32_t * size, uint32_t len) {
+
+	if (len <= *size) return 1;
+	uint32_t new_size = *size ? *size * 2 : 16;
+	while(new_size < len) new_size *= 2;
+	struct arena_range * new_ranges = realloc(*ranges, new_size * sizeof(struct arena_range));
+	if (!new_ranges) return 0;
+	*ranges = new_ranges;
+	*size = new_size;
+	return 1;
+}
+
+/* put a range back to the free list, merged with its neighbours */
+static void release(struct arena * arena, uint32_t offset, uint32_t len) {
+
+	uint32_t lo = 0, hi = arena->free_len;
+	while(lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (arena->free[mid].offset < offset) lo = mid + 1;
+		else hi = mid;
+	}
+
+	struct arena_range * prev = lo > 0 ? &arena->free[lo - 1] : NULL;
+	struct arena_range * next = lo < arena->free_len ? &arena->free[lo] : NULL;
+	int merge_prev = prev && prev->offset + prev->len == offset;
+	int merge_next = next && offset + len == next->offset;
+
+	if (merge_prev && merge_next) {
+		prev->len += len + next->len;
+		memmove(next, next + 1, (arena->free_len - lo - 1) * sizeof(struct arena_range));
+		arena->free_len--;
+	}
+	else if (merge_prev) {
+		prev->len += len;
+	}
+	else if (merge_next) {
+		next->offset = offset;
+		next->len += len;
+	}
+	else {
+		/* out of memory only leaks the range */
+		if (!reserve(&arena->free, &arena->free_size, arena->free_len + 1)) return;
+		memmove(arena->free + lo + 1, arena->free + lo, (arena->free_len - lo) * sizeof(struct arena_range));
+		arena->free[lo] = (struct arena_range){ .offset = offset, .len = len };
+		arena->free_len++;
+	}
+}
+
+struct arena * arena_create(uint32_t capacity) {
+
+	struct arena * arena = calloc(1, sizeof(struct arena));
+	if (!arena) return NULL;
+	arena_grow(arena, capacity);
+	return arena;
+}
+
+uint32_t arena_alloc(struct arena * arena, uint32_t len) {
+
+	uint32_t i;
+
+	if (!len) return 0;
+	for(i = 0; i < arena->free_len; i++) {
+		struct arena_range * range = &arena->free[i];
+		if (range->len < len) continue;
+
+		uint32_t offset = range->offset;
+		range->offset += len;
+		range->len -= len;
+		if (!range->len) {
+			memmove(range, range + 1, (arena->free_len - i - 1) * sizeof(struct arena_range));
+			arena->free_len--;
+		}
+		arena->used += len;
+		return offset;
+	}
+	return ARENA_NONE;
+}
+
+void arena_free(struct arena * arena, uint32_t offset, uint32_t len, uint64_t frame) {
+
+	if (!len) return;
+	assert(offset + len <= arena->capacity);
+	if (!reserve(&arena->retired, &arena->retired_size, arena->retired_len + 1)) return;
+	arena->retired[arena->retired_len++] = (struct arena_range){ .offset = offset, .len = len, .frame = frame };
+}
+
+void arena_collect(struct arena * arena, uint64_t frame) {
+
+	uint32_t i;
+
+	for(i = 0; i < arena->retired_len && arena->retired[i].frame <= frame; i++) {
+		release(arena, arena->retired[i].offset, arena->retired[i].len);
+		arena->used -= arena->retired[i].len;
+	}
+	if (!i) return;
+	memmove(arena->retired, arena->retired + i, (arena->retired_len - i) * sizeof(struct arena_range));
+	arena->retired_len -= i;
+}
+
+void arena_grow(struct arena * arena, uint32_t capacity) {
+
+	if (capacity <= arena->capacity) return;
+	release(arena, arena->capacity, capacity - arena->capacity);
+	arena->capacity = capacity;
+}
+
+uint32_t arena_capacity(const struct arena * arena) {
+
+	return arena->capacity;
+}
+
+uint32_t arena_used(const struct arena * arena) {
+
+	return arena->used;
+}
+
+void arena_destroy(struct arena * arena) {
+
+	if (!arena) return;
+	free(arena->free);
+	free(arena->retired);
+	free(arena);
+}
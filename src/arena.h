@@ -0,0 +1,41 @@
+#ifndef arena_h
+#define arena_h
+
+#include <stdint.h>
+
+/* Range allocator for the GPU buffers: hands out ranges of elements
+ * (vertices, indices, instances) from a buffer of 'capacity' elements.
+ *
+ * A freed range may still be read by the frames in flight, so it is only
+ * retired, stamped with the current frame number, and becomes available
+ * again once arena_collect() is called with a frame number past the frames
+ * which could use it.
+ *
+ * Free ranges are kept sorted and merged, allocation is first-fit.
+ */
+struct arena;
+
+#define ARENA_NONE UINT32_MAX
+
+struct arena * arena_create(uint32_t capacity);
+
+/* offset of a new range of len elements, ARENA_NONE when it does not fit */
+uint32_t arena_alloc(struct arena * arena, uint32_t len);
+
+/* retire a range, it is not handed out again before arena_collect(frame) */
+void arena_free(struct arena * arena, uint32_t offset, uint32_t len, uint64_t frame);
+
+/* make the ranges retired at or before 'frame' available */
+void arena_collect(struct arena * arena, uint64_t frame);
+
+/* extend the arena, the buffer has been reallocated with room for more */
+void arena_grow(struct arena * arena, uint32_t capacity);
+
+uint32_t arena_capacity(const struct arena * arena);
+
+/* elements in use or retired */
+uint32_t arena_used(const struct arena * arena);
+
+void arena_destroy(struct arena * arena);
+
+#endif
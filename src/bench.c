@@ -0,0 +1,446 @@
+/* Microbenchmarks of the math, mesh generation and buffer allocation code.
+ *
+ * Every benchmark prints one JSON object per line to stdout:
+ *
+ *   {"name": "mat4_mul", "param": 0, "iterations": 4194304, "ns_per_op": 3.12,
+ *    "ns_per_op_median": 3.20, "allocs_per_op": 0.00, "alloc_bytes_per_op": 0}
+ *
+ * ns_per_op is the best of the repeated runs, the iteration count is
+ * calibrated so one run takes at least --min-time. The allocations are
+ * counted by wrapping malloc(), calloc() and realloc() at link time
+ * (-Wl,--wrap=...), so only the calls from the benchmarked code count.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "linalg.h"
+#include "model.h"
+#include "models/sphere.h"
+#include "models/terrain.h"
+#include "arena.h"
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t nmemb, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+static uint64_t alloc_count, alloc_bytes;
+
+void * __wrap_malloc(size_t size) {
+	alloc_count++;
+	alloc_bytes += size;
+	return __real_malloc(size);
+}
+void * __wrap_calloc(size_t nmemb, size_t size) {
+	alloc_count++;
+	alloc_bytes += nmemb * size;
+	return __real_calloc(nmemb, size);
+}
+void * __wrap_realloc(void * ptr, size_t size) {
+	alloc_count++;
+	alloc_bytes += size;
+	return __real_realloc(ptr, size);
+}
+
+static struct {
+	const char * filter;
+	double min_time; /* seconds */
+	int repeat;
+} bench_options = {
+	.filter = NULL,
+	.min_time = 0.1,
+	.repeat = 5,
+};
+
+/* a benchmark performs 'iterations' operations per run,
+ * setup() and teardown() are not timed */
+struct benchmark {
+	const char * name;
+	int param;
+	void (*setup)(int param);
+	void (*run)(int param, uint64_t iterations);
+	void (*teardown)(void);
+};
+
+/* results are stored here, so the computations are not optimized out */
+static volatile float bench_sink;
+
+#define BENCH_MATS 256
+static Mat4 mats[BENCH_MATS], results[BENCH_MATS];
+static Vec3 points[BENCH_MATS];
+static uint32_t indices[BENCH_MATS];
+
+static struct model * model;
+static char heightmap_path[64];
+
+static double now(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* deterministic pseudo-random numbers, the same in every run */
+static uint32_t rand_state;
+static float rand_float(float min, float max) {
+
+	rand_state = rand_state * 1103515245 + 12345;
+	return min + (max - min) * ((rand_state >> 8) & 0xffff) / 65535.0f;
+}
+
+static void setup_mats(int param) {
+
+	int i;
+	rand_state = 1;
+	for(i = 0; i < BENCH_MATS; i++) {
+		mats[i] = mat4_rotate(mat4_translate(rand_float(-10, 10), rand_float(-10, 10), rand_float(-10, 10)),
+				rand_float(-1, 1), rand_float(-1, 1), rand_float(-1, 1), rand_float(0, 3));
+		points[i] = (Vec3){ rand_float(-100, 100), rand_float(0, 50), rand_float(-100, 100) };
+		indices[i] = i;
+	}
+}
+
+static void run_mat4_mul(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		results[i % BENCH_MATS] = mat4_mul(mats[i % BENCH_MATS], mats[(i + 1) % BENCH_MATS]);
+	}
+	bench_sink = results[0].a.x;
+}
+
+static void run_mat4_invert(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		results[i % BENCH_MATS] = mat4_invert(mats[i % BENCH_MATS]);
+	}
+	bench_sink = results[0].a.x;
+}
+
+static void run_mat4_view(int param, uint64_t iterations) {
+
+	uint64_t i;
+	Vec3 up = { 0.0f, -1.0f, 0.0f };
+	for(i = 0; i < iterations; i++) {
+		results[i % BENCH_MATS] = mat4_view(points[i % BENCH_MATS], points[(i + 1) % BENCH_MATS], up);
+	}
+	bench_sink = results[0].a.x;
+}
+
+/* one operation is one object */
+static void run_mat4_batch_instances(int param, uint64_t iterations) {
+
+	static Mat4 out[BENCH_MATS][3];
+	Mat4 v = mat4_view(points[0], points[1], (Vec3){ 0.0f, -1.0f, 0.0f });
+	Mat4 p = mat4_perspective(1.0f, 1.0f, 1.0f, 500.0f);
+	uint64_t i, n;
+
+	for(i = 0; i < iterations; i += n) {
+		n = iterations - i < BENCH_MATS ? iterations - i : BENCH_MATS;
+		mat4_batch_instances(mats, indices, n, param, v, p, out, sizeof(out[0]));
+	}
+	bench_sink = out[0][0].a.x;
+}
+
+/* smooth hills with some noise, 8-bit samples */
+static void setup_heightmap(int size) {
+
+	int fd, x, z;
+	unsigned char * data = malloc((size_t)size * size);
+
+	rand_state = 1;
+	for(z = 0; z < size; z++) {
+		for(x = 0; x < size; x++) {
+			float h = 80.0f + 40.0f * sinf(x * 0.05f) * cosf(z * 0.07f) + rand_float(0, 8);
+			data[z * size + x] = (unsigned char)h;
+		}
+	}
+
+	const char * tmpdir = getenv("TMPDIR");
+	snprintf(heightmap_path, sizeof(heightmap_path), "%s/vulkanplay_bench_XXXXXX", tmpdir ? tmpdir : "/tmp");
+	fd = mkstemp(heightmap_path);
+	if (fd < 0 || write(fd, data, (size_t)size * size) != (ssize_t)size * size) {
+		perror(heightmap_path);
+		exit(1);
+	}
+	close(fd);
+	free(data);
+}
+
+static void teardown_heightmap(void) {
+
+	unlink(heightmap_path);
+	heightmap_path[0] = '\0';
+}
+
+static void run_create_terrain(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		struct model * terrain = create_terrain(param, param, heightmap_path, 32, false);
+		bench_sink = terrain->vertices[0].pos.y;
+		destroy_model(terrain);
+	}
+}
+
+static void setup_terrain(int param) {
+
+	setup_heightmap(param);
+	model = create_terrain(param, param, heightmap_path, 32, false);
+	setup_mats(0);
+}
+
+static void teardown_model(void) {
+
+	destroy_model(model);
+	model = NULL;
+}
+
+static void teardown_terrain(void) {
+
+	teardown_model();
+	teardown_heightmap();
+}
+
+static void run_sample_terrain_height(int param, uint64_t iterations) {
+
+	uint64_t i;
+	float sum = 0.0f;
+	for(i = 0; i < iterations; i++) {
+		Vec3 p = points[i % BENCH_MATS];
+		sum += sample_terrain_height(model, p.x, p.z);
+	}
+	bench_sink = sum;
+}
+
+static void run_create_sphere(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		struct model * sphere = create_sphere(1, param, 1.0f);
+		bench_sink = sphere->vertices[0].pos.y;
+		destroy_model(sphere);
+	}
+}
+
+static void setup_sphere(int param) {
+
+	model = create_sphere(1, param, 1.0f);
+}
+
+static void run_model_compute_normals(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		model_compute_normals(model);
+	}
+	bench_sink = model->vertices[0].normal.x;
+}
+
+#define BENCH_RANGES 16384
+static struct arena * arena;
+static uint32_t range_offset[BENCH_RANGES], range_len[BENCH_RANGES];
+
+static void arena_alloc_range(uint32_t k) {
+
+	range_len[k] = 1 + (uint32_t)rand_float(0.0f, 1000.0f);
+	range_offset[k] = arena_alloc(arena, range_len[k]);
+	if (range_offset[k] == ARENA_NONE) {
+		arena_grow(arena, arena_capacity(arena) + arena_capacity(arena) / 2 + range_len[k]);
+		range_offset[k] = arena_alloc(arena, range_len[k]);
+	}
+}
+
+/* param live ranges, like as many scene objects with their meshes */
+static void setup_arena(int param) {
+
+	uint32_t k;
+	rand_state = 1;
+	arena = arena_create(1024);
+	for(k = 0; k < (uint32_t)param; k++) arena_alloc_range(k);
+}
+
+static void teardown_arena(void) {
+
+	arena_destroy(arena);
+	arena = NULL;
+}
+
+/* remove an object and add another one each frame */
+static void run_arena_churn(int param, uint64_t iterations) {
+
+	uint64_t i;
+	for(i = 0; i < iterations; i++) {
+		uint32_t k = (uint32_t)(i * 7919) % (uint32_t)param;
+		arena_free(arena, range_offset[k], range_len[k], i);
+		if (i >= 3) arena_collect(arena, i - 3);
+		arena_alloc_range(k);
+	}
+	bench_sink = (float)arena_used(arena);
+}
+
+static const struct benchmark benchmarks[] = {
+	{ "mat4_mul", 0, setup_mats, run_mat4_mul, NULL },
+	{ "mat4_invert", 0, setup_mats, run_mat4_invert, NULL },
+	{ "mat4_view", 0, setup_mats, run_mat4_view, NULL },
+	{ "mat4_batch_instances", MAT4_CLASS_GENERAL, setup_mats, run_mat4_batch_instances, NULL },
+	{ "mat4_batch_instances", MAT4_CLASS_RIGID, setup_mats, run_mat4_batch_instances, NULL },
+	{ "create_terrain", 64, setup_heightmap, run_create_terrain, teardown_heightmap },
+	{ "create_terrain", 128, setup_heightmap, run_create_terrain, teardown_heightmap },
+	{ "create_terrain", 256, setup_heightmap, run_create_terrain, teardown_heightmap },
+	{ "create_terrain", 512, setup_heightmap, run_create_terrain, teardown_heightmap },
+	{ "sample_terrain_height", 256, setup_terrain, run_sample_terrain_height, teardown_terrain },
+	{ "create_sphere", 8, NULL, run_create_sphere, NULL },
+	{ "create_sphere", 32, NULL, run_create_sphere, NULL },
+	{ "create_sphere", 128, NULL, run_create_sphere, NULL },
+	{ "model_compute_normals", 8, setup_sphere, run_model_compute_normals, teardown_model },
+	{ "model_compute_normals", 128, setup_sphere, run_model_compute_normals, teardown_model },
+	{ "arena_churn", 1024, setup_arena, run_arena_churn, teardown_arena },
+	{ "arena_churn", 16384, setup_arena, run_arena_churn, teardown_arena },
+};
+
+static int compare_double(const void * a, const void * b) {
+
+	double da = *(const double *)a, db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+static void run_benchmark(FILE * out, const struct benchmark * b) {
+
+	uint64_t iterations = 1;
+	double elapsed, times[64];
+	uint64_t allocs, bytes;
+	int i;
+
+	if (b->setup) b->setup(b->param);
+
+	// calibrate, the iteration count grows until a run is long enough
+	for(;;) {
+		elapsed = now();
+		b->run(b->param, iterations);
+		elapsed = now() - elapsed;
+		if (elapsed >= bench_options.min_time) break;
+		if (elapsed < bench_options.min_time / 16) iterations *= 8;
+		else iterations *= 2;
+	}
+
+	allocs = alloc_count;
+	bytes = alloc_bytes;
+	for(i = 0; i < bench_options.repeat; i++) {
+		times[i] = now();
+		b->run(b->param, iterations);
+		times[i] = (now() - times[i]) / iterations * 1e9;
+	}
+	allocs = alloc_count - allocs;
+	bytes = alloc_bytes - bytes;
+
+	if (b->teardown) b->teardown();
+
+	qsort(times, bench_options.repeat, sizeof(double), compare_double);
+
+	uint64_t ops = iterations * bench_options.repeat;
+	fprintf(out, "{\"name\": \"%s\", \"param\": %i, \"iterations\": %llu, "
+			"\"ns_per_op\": %.2f, \"ns_per_op_median\": %.2f, "
+			"\"allocs_per_op\": %.2f, \"alloc_bytes_per_op\": %llu}\n",
+			b->name, b->param, (unsigned long long)iterations,
+			times[0], times[bench_options.repeat / 2],
+			(double)allocs / ops, (unsigned long long)(bytes / ops));
+	fflush(out);
+}
+
+static void usage(FILE * fp, const char * name) {
+
+	fprintf(fp, "\n"
+"Usage:\n"
+"\n"
+"    %s [OPTIONS]\n"
+"\n"
+"Options:\n"
+"    --help, -h                this message\n"
+"    --filter=TEXT             run only the benchmarks with TEXT in the name\n"
+"    --min-time=VALUE          minimum time of a run, in milliseconds\n"
+"    --repeat=VALUE            number of timed runs (1-64)\n"
+"    --list                    list the benchmarks\n"
+"\n", name);
+}
+
+int main(int argc, char ** argv) {
+
+	int i;
+	size_t j;
+	char * opt = NULL;
+	char * arg = NULL;
+	for(i = 1; i < argc; i++) {
+		opt = argv[i];
+		arg = NULL;
+		if (opt[0] == '-' && opt[1] == '-') {
+			char * p = strchr(opt, '=');
+			if (p) {
+				*p = '\000';
+				arg = p + 1;
+			}
+		}
+		if (!strcmp(opt, "-h") || !strcmp(opt, "--help")) {
+			usage(stdout, argv[0]);
+			exit(0);
+		}
+		else if (!strcmp(opt, "--list")) {
+			for(j = 0; j < sizeof(benchmarks) / sizeof(benchmarks[0]); j++) {
+				printf("%s %i\n", benchmarks[j].name, benchmarks[j].param);
+			}
+			exit(0);
+		}
+		else if (!strcmp(opt, "--filter")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			bench_options.filter = arg;
+		}
+		else if (!strcmp(opt, "--min-time")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			int val = atoi(arg);
+			if (val <= 0) break;
+			bench_options.min_time = val / 1000.0;
+		}
+		else if (!strcmp(opt, "--repeat")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			int val = atoi(arg);
+			if (val <= 0 || val > 64) break;
+			bench_options.repeat = val;
+		}
+		else break;
+	}
+	if (i < argc) {
+		fprintf(stderr, "Invalid argument: %s %s\n", opt,
+							arg ? arg : "");
+		usage(stderr, argv[0]);
+		exit(1);
+	}
+
+	// the model generators print reports, keep them out of the results
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!out || !freopen("/dev/null", "w", stdout)) {
+		perror("stdout");
+		exit(1);
+	}
+
+	for(j = 0; j < sizeof(benchmarks) / sizeof(benchmarks[0]); j++) {
+		const struct benchmark * b = &benchmarks[j];
+		if (bench_options.filter && !strstr(b->name, bench_options.filter)) continue;
+		run_benchmark(out, b);
+	}
+
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "frame_pacer.h"
+#include "timing.h"
+
+/* how long before the deadline the sleep ends and the spin starts, in seconds */
+#define FRAME_PACER_SPIN 0.001
+
+/* running statistics of the intervals between events */
+struct interval_stats {
+	double last; /* time of the last event, 0 before the first one */
+	uint32_t count;
+	double sum, sum2, min, max;
+};
+
+struct frame_pacer {
+	double frame_time;
+	double deadline; /* of the next frame, 0 before the first one */
+
+	struct interval_stats starts; /* frame_pacer_wait() returns */
+	struct interval_stats presents; /* frame_pacer_presented() times */
+};
+
+static void stats_add(struct interval_stats * stats, double time) {
+
+	if (stats->last > 0.0 && time > stats->last) {
+		double interval = time - stats->last;
+		if (!stats->count || interval < stats->min) stats->min = interval;
+		if (interval > stats->max) stats->max = interval;
+		stats->sum += interval;
+		stats->sum2 += interval * interval;
+		stats->count++;
+	}
+	stats->last = time;
+}
+
+static void stats_print(const char * name, struct interval_stats * stats) {
+
+	if (!stats->count) return;
+
+	double avg = stats->sum / stats->count;
+	double variance = stats->sum2 / stats->count - avg * avg;
+	if (variance < 0.0) variance = 0.0;
+	printf("  %-8s interval: avg %.3f ms, std dev %.3f ms, min %.3f ms, max %.3f ms\n", name,
+			1000.0 * avg, 1000.0 * sqrt(variance), 1000.0 * stats->min, 1000.0 * stats->max);
+
+	/* keep the last event time, the next interval starts there */
+	stats->count = 0;
+	stats->sum = stats->sum2 = 0.0;
+	stats->min = stats->max = 0.0;
+}
+
+struct frame_pacer * frame_pacer_create(double frame_time) {
+
+	struct frame_pacer * pacer = calloc(1, sizeof(struct frame_pacer));
+	if (!pacer) return NULL;
+
+	pacer->frame_time = frame_time;
+	return pacer;
+}
+
+void frame_pacer_set_refresh(struct frame_pacer * pacer, double refresh) {
+
+	if (refresh <= 0.0) return;
+
+	/* the nearest whole number of cycles, at least one */
+	double cycles = floor(pacer->frame_time / refresh + 0.5);
+	if (cycles < 1.0) cycles = 1.0;
+
+	pacer->frame_time = cycles * refresh;
+	printf("display refresh %.3f ms, frame time %.3f ms (%.0f cycles)\n",
+			1000.0 * refresh, 1000.0 * pacer->frame_time, cycles);
+}
+
+void frame_pacer_wait(struct frame_pacer * pacer) {
+
+	double now = timing_now();
+
+	if (pacer->deadline == 0.0 || pacer->deadline + pacer->frame_time < now) {
+		/* the first frame, or late by more than a frame: do not try to catch up */
+		pacer->deadline = now;
+	}
+	else {
+		if (pacer->deadline - now > FRAME_PACER_SPIN) {
+			timing_sleep_until(pacer->deadline - FRAME_PACER_SPIN);
+		}
+		while ((now = timing_now()) < pacer->deadline);
+	}
+	stats_add(&pacer->starts, now);
+	pacer->deadline += pacer->frame_time;
+}
+
+void frame_pacer_presented(struct frame_pacer * pacer, double time) {
+
+	stats_add(&pacer->presents, time);
+}
+
+void frame_pacer_report(struct frame_pacer * pacer) {
+
+	printf("frame pacing, target %.3f ms:\n", 1000.0 * pacer->frame_time);
+	stats_print("start", &pacer->starts);
+	stats_print("present", &pacer->presents);
+}
+
+void frame_pacer_destroy(struct frame_pacer * pacer) {
+
+	free(pacer);
+}
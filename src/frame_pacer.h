@@ -0,0 +1,32 @@
+#ifndef frame_pacer_h
+#define frame_pacer_h
+
+/* Frame rate limiter for --fps-cap.
+ *
+ * Frames start at absolute deadlines, frame_time apart, so an early or
+ * late wakeup does not shift the following frames. frame_pacer_wait()
+ * sleeps until just before the deadline and spins the rest of the way,
+ * as a sleep may overshoot by more than the accuracy wanted.
+ *
+ * The intervals between the frame starts, and between the presents when the
+ * presentation engine reports them, are collected for frame_pacer_report().
+ */
+struct frame_pacer;
+
+struct frame_pacer * frame_pacer_create(double frame_time);
+
+/* round the frame time to whole display refresh cycles of 'refresh' seconds */
+void frame_pacer_set_refresh(struct frame_pacer * pacer, double refresh);
+
+/* wait until the next frame's deadline */
+void frame_pacer_wait(struct frame_pacer * pacer);
+
+/* a frame was shown at 'time' (seconds), from the present timing feedback */
+void frame_pacer_presented(struct frame_pacer * pacer, double time);
+
+/* print the frame interval statistics since the last report, and reset them */
+void frame_pacer_report(struct frame_pacer * pacer);
+
+void frame_pacer_destroy(struct frame_pacer * pacer);
+
+#endif
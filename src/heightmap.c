@@ -0,0 +1,145 @@
+#include "heightmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* tiles are HM_TILE_SIZE x HM_TILE_SIZE samples */
+#define HM_TILE_SHIFT 6
+#define HM_TILE_SIZE (1 << HM_TILE_SHIFT)
+#define HM_TILE_MASK (HM_TILE_SIZE - 1)
+
+struct heightmap {
+	uint32_t width, depth;
+	float sea_level;
+
+	/* mapped file, NULL for a flat map */
+	const unsigned char * data;
+	size_t data_size;
+	int sample_size; /* bytes per sample, 1 or 2 */
+
+	/* converted tiles, NULL until first used */
+	uint32_t tiles_x, tiles_z;
+	float ** tiles;
+	uint32_t tiles_resident;
+};
+
+struct heightmap * heightmap_open(const char * path, uint32_t width, uint32_t depth, float sea_level) {
+
+	struct stat st;
+	int fd = -1;
+
+	struct heightmap * hm = (struct heightmap *)calloc(1, sizeof(struct heightmap));
+	hm->width = width;
+	hm->depth = depth;
+	hm->sea_level = sea_level;
+	hm->tiles_x = (width + HM_TILE_SIZE - 1) >> HM_TILE_SHIFT;
+	hm->tiles_z = (depth + HM_TILE_SIZE - 1) >> HM_TILE_SHIFT;
+	hm->tiles = (float **)calloc(hm->tiles_x * hm->tiles_z, sizeof(float *));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return hm;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		goto error;
+	}
+
+	size_t samples = (size_t)width * depth;
+	if ((size_t)st.st_size == samples) {
+		hm->sample_size = 1;
+	}
+	else if ((size_t)st.st_size == samples * 2) {
+		hm->sample_size = 2;
+	}
+	else {
+		fprintf(stderr, "%s: %lli bytes does not match a %ux%u 8 or 16-bit heightmap\n",
+				path, (long long)st.st_size, width, depth);
+		goto error;
+	}
+
+	void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror(path);
+		goto error;
+	}
+	// a tile touches short pieces of many rows, read-ahead would be mostly wasted
+	madvise(data, st.st_size, MADV_RANDOM);
+
+	hm->data = (const unsigned char *)data;
+	hm->data_size = st.st_size;
+	close(fd);
+	return hm;
+error:
+	if (fd >= 0) close(fd);
+	return hm;
+}
+
+static float * load_tile(struct heightmap * hm, uint32_t tx, uint32_t tz) {
+
+	uint32_t x, z;
+	float * tile = (float *)malloc(HM_TILE_SIZE * HM_TILE_SIZE * sizeof(float));
+
+	for(z = 0; z < HM_TILE_SIZE; z++) {
+		uint32_t mz = (tz << HM_TILE_SHIFT) + z;
+		float * row = tile + z * HM_TILE_SIZE;
+		for(x = 0; x < HM_TILE_SIZE; x++) {
+			uint32_t mx = (tx << HM_TILE_SHIFT) + x;
+			float h = 0.0f;
+			if (hm->data && mx < hm->width && mz < hm->depth) {
+				size_t offset = (size_t)mz * hm->width + mx;
+				if (hm->sample_size == 1) {
+					h = hm->data[offset];
+				}
+				else {
+					const unsigned char * p = hm->data + offset * 2;
+					h = (float)(p[0] | (p[1] << 8)) / 256.0f;
+				}
+			}
+			row[x] = h - hm->sea_level;
+		}
+	}
+	hm->tiles_resident++;
+	return tile;
+}
+
+float heightmap_get(struct heightmap * hm, int32_t x, int32_t z) {
+
+	if (x < 0) x = 0;
+	else if (x >= hm->width) x = hm->width - 1;
+	if (z < 0) z = 0;
+	else if (z >= hm->depth) z = hm->depth - 1;
+
+	uint32_t t = (z >> HM_TILE_SHIFT) * hm->tiles_x + (x >> HM_TILE_SHIFT);
+	float * tile = hm->tiles[t];
+	if (!tile) {
+		tile = hm->tiles[t] = load_tile(hm, x >> HM_TILE_SHIFT, z >> HM_TILE_SHIFT);
+	}
+	return tile[((z & HM_TILE_MASK) << HM_TILE_SHIFT) + (x & HM_TILE_MASK)];
+}
+
+void heightmap_release_tiles(struct heightmap * hm) {
+
+	uint32_t i;
+	for(i = 0; i < hm->tiles_x * hm->tiles_z; i++) {
+		if (hm->tiles[i]) {
+			free(hm->tiles[i]);
+			hm->tiles[i] = NULL;
+		}
+	}
+	hm->tiles_resident = 0;
+}
+
+void heightmap_close(struct heightmap * hm) {
+
+	heightmap_release_tiles(hm);
+	free(hm->tiles);
+	if (hm->data) munmap((void *)hm->data, hm->data_size);
+	free(hm);
+}
@@ -0,0 +1,27 @@
+#ifndef heightmap_h
+#define heightmap_h
+
+#include <stdint.h>
+
+/* Heightmap file, memory-mapped and converted to floats lazily, by tiles.
+ *
+ * The file holds width * depth samples, row by row, either 8-bit or 16-bit
+ * (little-endian), detected from the file size. 16-bit samples are scaled to
+ * the 8-bit range, so both give heights in 0 - 255 (minus the sea level).
+ *
+ * Not thread-safe: tiles are converted on first access.
+ */
+struct heightmap;
+
+/* a missing or invalid file gives a flat heightmap */
+struct heightmap * heightmap_open(const char * path, uint32_t width, uint32_t depth, float sea_level);
+
+/* height at column x, row z; coordinates are clamped to the map */
+float heightmap_get(struct heightmap * heightmap, int32_t x, int32_t z);
+
+/* release the converted tiles, they will be converted again when needed */
+void heightmap_release_tiles(struct heightmap * heightmap);
+
+void heightmap_close(struct heightmap * heightmap);
+
+#endif
@@ -2,6 +2,29 @@
 #define linalg_h
 
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* SIMD implementations of the hot Mat4 operations are selected at compile
+ * time; define LINALG_NO_SIMD to use the scalar ones everywhere */
+#if !defined(LINALG_NO_SIMD) && defined(__SSE__)
+#define LINALG_SSE 1
+#include <xmmintrin.h>
+#if defined(__AVX__)
+#define LINALG_AVX 1
+#include <immintrin.h>
+#define LINALG_SIMD_NAME "AVX"
+#else
+#define LINALG_SIMD_NAME "SSE"
+#endif
+#elif !defined(LINALG_NO_SIMD) && defined(__ARM_NEON)
+#define LINALG_NEON 1
+#include <arm_neon.h>
+#define LINALG_SIMD_NAME "NEON"
+#else
+#define LINALG_SIMD_NAME "none"
+#endif
 
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
@@ -159,7 +182,7 @@ static const Mat4 MAT4_IDENTITY = {
 	{ 0, 0, 1, 0 },
 	{ 0, 0, 0, 1 }};
 
-static inline Mat4 mat4_transpose(const Mat4 n) {
+static inline Mat4 mat4_transpose_scalar(const Mat4 n) {
 	Mat4 m;
 	const float * N = (const float *)&n;
 	float * M = (float *)&m;
@@ -202,7 +225,7 @@ static inline Mat4 mat4_scale_aniso(const Mat4 a, float x, float y, float z) {
 	m.d = a.d;
 	return m;
 }
-static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
+static inline Mat4 mat4_mul_scalar(const Mat4 a, const Mat4 b) {
 	Mat4 m;
 	float * A = (float *)&a;
 	float * B = (float *)&b;
@@ -218,7 +241,7 @@ static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
 	}
 	return m;
 }
-static inline Vec4 mat4_mul_vec4(const Mat4 m, const Vec4 v) {
+static inline Vec4 mat4_mul_vec4_scalar(const Mat4 m, const Vec4 v) {
 	Vec4 r;
 	const float * M = (const float *)&m;
 	const float * V = (const float *)&v;
@@ -233,6 +256,124 @@ static inline Vec4 mat4_mul_vec4(const Mat4 m, const Vec4 v) {
 	return r;
 }
 
+/* the SIMD versions accumulate in the same order as the scalar ones, the
+ * results may only differ when the compiler fuses multiply-adds */
+#if defined(LINALG_SSE)
+static inline Mat4 mat4_transpose(const Mat4 n) {
+	Mat4 m;
+	const float * N = (const float *)&n;
+	float * M = (float *)&m;
+	__m128 c0 = _mm_loadu_ps(N), c1 = _mm_loadu_ps(N + 4);
+	__m128 c2 = _mm_loadu_ps(N + 8), c3 = _mm_loadu_ps(N + 12);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_mm_storeu_ps(M, c0);
+	_mm_storeu_ps(M + 4, c1);
+	_mm_storeu_ps(M + 8, c2);
+	_mm_storeu_ps(M + 12, c3);
+	return m;
+}
+#if defined(LINALG_AVX)
+static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
+	Mat4 m;
+	const float * A = (const float *)&a;
+	const float * B = (const float *)&b;
+	float * M = (float *)&m;
+	/* two result columns at a time, each 128-bit lane holds one */
+	__m256 a0 = _mm256_broadcast_ps((const __m128 *)A);
+	__m256 a1 = _mm256_broadcast_ps((const __m128 *)(A + 4));
+	__m256 a2 = _mm256_broadcast_ps((const __m128 *)(A + 8));
+	__m256 a3 = _mm256_broadcast_ps((const __m128 *)(A + 12));
+	int c;
+	for (c = 0; c < 4; c += 2) {
+		__m256 bc = _mm256_loadu_ps(B + c * 4);
+		__m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(bc, bc, 0x00));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_shuffle_ps(bc, bc, 0x55)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_shuffle_ps(bc, bc, 0xaa)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_shuffle_ps(bc, bc, 0xff)));
+		_mm256_storeu_ps(M + c * 4, r);
+	}
+	return m;
+}
+#else
+static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
+	Mat4 m;
+	const float * A = (const float *)&a;
+	const float * B = (const float *)&b;
+	float * M = (float *)&m;
+	__m128 a0 = _mm_loadu_ps(A), a1 = _mm_loadu_ps(A + 4);
+	__m128 a2 = _mm_loadu_ps(A + 8), a3 = _mm_loadu_ps(A + 12);
+	int c;
+	for (c = 0; c < 4; ++c) {
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(B[c * 4 + 0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(B[c * 4 + 1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(B[c * 4 + 2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(B[c * 4 + 3])));
+		_mm_storeu_ps(M + c * 4, r);
+	}
+	return m;
+}
+#endif
+static inline Vec4 mat4_mul_vec4(const Mat4 m, const Vec4 v) {
+	Vec4 r;
+	const float * M = (const float *)&m;
+	__m128 R = _mm_mul_ps(_mm_loadu_ps(M), _mm_set1_ps(v.x));
+	R = _mm_add_ps(R, _mm_mul_ps(_mm_loadu_ps(M + 4), _mm_set1_ps(v.y)));
+	R = _mm_add_ps(R, _mm_mul_ps(_mm_loadu_ps(M + 8), _mm_set1_ps(v.z)));
+	R = _mm_add_ps(R, _mm_mul_ps(_mm_loadu_ps(M + 12), _mm_set1_ps(v.w)));
+	_mm_storeu_ps((float *)&r, R);
+	return r;
+}
+#elif defined(LINALG_NEON)
+static inline Mat4 mat4_transpose(const Mat4 n) {
+	Mat4 m;
+	float * M = (float *)&m;
+	/* de-interleaving load: val[i] gets every fourth float, from i */
+	float32x4x4_t t = vld4q_f32((const float *)&n);
+	vst1q_f32(M, t.val[0]);
+	vst1q_f32(M + 4, t.val[1]);
+	vst1q_f32(M + 8, t.val[2]);
+	vst1q_f32(M + 12, t.val[3]);
+	return m;
+}
+static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
+	Mat4 m;
+	const float * A = (const float *)&a;
+	const float * B = (const float *)&b;
+	float * M = (float *)&m;
+	float32x4_t a0 = vld1q_f32(A), a1 = vld1q_f32(A + 4);
+	float32x4_t a2 = vld1q_f32(A + 8), a3 = vld1q_f32(A + 12);
+	int c;
+	for (c = 0; c < 4; ++c) {
+		float32x4_t r = vmulq_n_f32(a0, B[c * 4 + 0]);
+		r = vaddq_f32(r, vmulq_n_f32(a1, B[c * 4 + 1]));
+		r = vaddq_f32(r, vmulq_n_f32(a2, B[c * 4 + 2]));
+		r = vaddq_f32(r, vmulq_n_f32(a3, B[c * 4 + 3]));
+		vst1q_f32(M + c * 4, r);
+	}
+	return m;
+}
+static inline Vec4 mat4_mul_vec4(const Mat4 m, const Vec4 v) {
+	Vec4 r;
+	const float * M = (const float *)&m;
+	float32x4_t R = vmulq_n_f32(vld1q_f32(M), v.x);
+	R = vaddq_f32(R, vmulq_n_f32(vld1q_f32(M + 4), v.y));
+	R = vaddq_f32(R, vmulq_n_f32(vld1q_f32(M + 8), v.z));
+	R = vaddq_f32(R, vmulq_n_f32(vld1q_f32(M + 12), v.w));
+	vst1q_f32((float *)&r, R);
+	return r;
+}
+#else
+static inline Mat4 mat4_transpose(const Mat4 n) {
+	return mat4_transpose_scalar(n);
+}
+static inline Mat4 mat4_mul(const Mat4 a, const Mat4 b) {
+	return mat4_mul_scalar(a, b);
+}
+static inline Vec4 mat4_mul_vec4(const Mat4 m, const Vec4 v) {
+	return mat4_mul_vec4_scalar(m, v);
+}
+#endif
+
 static inline Mat4 mat4_translate(float x, float y, float z) {
 	Mat4 t = MAT4_IDENTITY;
 
@@ -324,7 +465,7 @@ static inline Mat4 mat4_rotate_Z(const Mat4 M, float angle) {
                 {0.f, 0.f, 0.f, 1.f}};
     return mat4_mul(M, R);
 }
-static inline Mat4 mat4_invert(const Mat4 m) {
+static inline Mat4 mat4_invert_scalar(const Mat4 m) {
 	Mat4 t;
 	const float * M = (const float *)&m;
 	float * T = (float *)&t;
@@ -371,6 +512,95 @@ static inline Mat4 mat4_invert(const Mat4 m) {
 
 	return t;
 }
+#if defined(LINALG_SSE)
+/* _mm_shuffle_ps() selector: x, y from the first argument, z, w from the second */
+#define LINALG_SHUF(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+
+/* 2x2 matrices, packed in one vector as (m00, m01, m10, m11) */
+static inline __m128 mat2_mul_sse(__m128 a, __m128 b) {
+	return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, LINALG_SHUF(0, 3, 0, 3))),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, LINALG_SHUF(1, 0, 3, 2)),
+				_mm_shuffle_ps(b, b, LINALG_SHUF(2, 1, 2, 1))));
+}
+/* adj(a) * b */
+static inline __m128 mat2_adj_mul_sse(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, LINALG_SHUF(3, 3, 0, 0)), b),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, LINALG_SHUF(1, 1, 2, 2)),
+				_mm_shuffle_ps(b, b, LINALG_SHUF(2, 3, 0, 1))));
+}
+/* a * adj(b) */
+static inline __m128 mat2_mul_adj_sse(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, LINALG_SHUF(3, 0, 3, 0))),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, LINALG_SHUF(1, 0, 3, 2)),
+				_mm_shuffle_ps(b, b, LINALG_SHUF(2, 1, 2, 1))));
+}
+
+/* block-wise inverse: the matrix is split into 2x2 blocks
+ *     | A B |
+ *     | C D |
+ * and the inverse is assembled from their adjugates and determinants.
+ * The formulas are for rows, applied to the columns they give the
+ * transposed inverse of the transposed matrix, which is the same thing.
+ */
+static inline Mat4 mat4_invert(const Mat4 m) {
+	Mat4 t;
+	const float * M = (const float *)&m;
+	float * T = (float *)&t;
+	__m128 c0 = _mm_loadu_ps(M), c1 = _mm_loadu_ps(M + 4);
+	__m128 c2 = _mm_loadu_ps(M + 8), c3 = _mm_loadu_ps(M + 12);
+
+	__m128 A = _mm_movelh_ps(c0, c1);
+	__m128 B = _mm_movehl_ps(c1, c0);
+	__m128 C = _mm_movelh_ps(c2, c3);
+	__m128 D = _mm_movehl_ps(c3, c2);
+
+	/* (|A|, |B|, |C|, |D|) */
+	__m128 det_sub = _mm_sub_ps(
+			_mm_mul_ps(_mm_shuffle_ps(c0, c2, LINALG_SHUF(0, 2, 0, 2)),
+				_mm_shuffle_ps(c1, c3, LINALG_SHUF(1, 3, 1, 3))),
+			_mm_mul_ps(_mm_shuffle_ps(c0, c2, LINALG_SHUF(1, 3, 1, 3)),
+				_mm_shuffle_ps(c1, c3, LINALG_SHUF(0, 2, 0, 2))));
+	__m128 det_a = _mm_shuffle_ps(det_sub, det_sub, LINALG_SHUF(0, 0, 0, 0));
+	__m128 det_b = _mm_shuffle_ps(det_sub, det_sub, LINALG_SHUF(1, 1, 1, 1));
+	__m128 det_c = _mm_shuffle_ps(det_sub, det_sub, LINALG_SHUF(2, 2, 2, 2));
+	__m128 det_d = _mm_shuffle_ps(det_sub, det_sub, LINALG_SHUF(3, 3, 3, 3));
+
+	__m128 d_c = mat2_adj_mul_sse(D, C);
+	__m128 a_b = mat2_adj_mul_sse(A, B);
+
+	/* adjugates of the result blocks */
+	__m128 X = _mm_sub_ps(_mm_mul_ps(det_d, A), mat2_mul_sse(B, d_c));
+	__m128 W = _mm_sub_ps(_mm_mul_ps(det_a, D), mat2_mul_sse(C, a_b));
+	__m128 Y = _mm_sub_ps(_mm_mul_ps(det_b, C), mat2_mul_adj_sse(D, a_b));
+	__m128 Z = _mm_sub_ps(_mm_mul_ps(det_c, B), mat2_mul_adj_sse(A, d_c));
+
+	/* |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C) */
+	__m128 tr = _mm_mul_ps(a_b, _mm_shuffle_ps(d_c, d_c, LINALG_SHUF(0, 2, 1, 3)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, LINALG_SHUF(2, 3, 0, 1)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, LINALG_SHUF(1, 0, 3, 2)));
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+
+	/* Assumes it is invertible */
+	__m128 idet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+	X = _mm_mul_ps(X, idet);
+	Y = _mm_mul_ps(Y, idet);
+	Z = _mm_mul_ps(Z, idet);
+	W = _mm_mul_ps(W, idet);
+
+	/* adjugate of the blocks combined with the re-assembly */
+	_mm_storeu_ps(T, _mm_shuffle_ps(X, Y, LINALG_SHUF(3, 1, 3, 1)));
+	_mm_storeu_ps(T + 4, _mm_shuffle_ps(X, Y, LINALG_SHUF(2, 0, 2, 0)));
+	_mm_storeu_ps(T + 8, _mm_shuffle_ps(Z, W, LINALG_SHUF(3, 1, 3, 1)));
+	_mm_storeu_ps(T + 12, _mm_shuffle_ps(Z, W, LINALG_SHUF(2, 0, 2, 0)));
+	return t;
+}
+#else
+/* NEON has no single-instruction equivalent of the arbitrary shuffles the
+ * block-wise inverse is built on, so it keeps the scalar version */
+static inline Mat4 mat4_invert(const Mat4 m) {
+	return mat4_invert_scalar(m);
+}
+#endif
 static inline Mat4 mat4_orthonormalize(const Mat4 m) {
 	Mat4 r = m;
 	float s = 1.0;
@@ -501,4 +731,255 @@ static inline Mat4 mat4_view(const Vec3 eye_pos, const Vec3 eye_dir, const Vec3
 	return m;
 }
 
+/* classes of transformations, allowing cheaper inverses and normal matrices */
+enum mat4_class {
+	MAT4_CLASS_RIGID,   /* rotation and translation */
+	MAT4_CLASS_UNIFORM, /* uniform scale, rotation and translation */
+	MAT4_CLASS_SCALED,  /* per-axis scale, then rotation and translation */
+	MAT4_CLASS_GENERAL,
+};
+#define MAT4_CLASS_COUNT 4
+
+/* find the most specific class of the transformation, the first three
+ * columns of an affine matrix must be orthogonal for any but the general */
+static inline enum mat4_class mat4_classify(const Mat4 m) {
+	const float eps = 1e-5f;
+
+	if (m.a.w != 0.0f || m.b.w != 0.0f || m.c.w != 0.0f || m.d.w != 1.0f) return MAT4_CLASS_GENERAL;
+
+	float aa = m.a.x * m.a.x + m.a.y * m.a.y + m.a.z * m.a.z;
+	float bb = m.b.x * m.b.x + m.b.y * m.b.y + m.b.z * m.b.z;
+	float cc = m.c.x * m.c.x + m.c.y * m.c.y + m.c.z * m.c.z;
+	float ab = m.a.x * m.b.x + m.a.y * m.b.y + m.a.z * m.b.z;
+	float ac = m.a.x * m.c.x + m.a.y * m.c.y + m.a.z * m.c.z;
+	float bc = m.b.x * m.c.x + m.b.y * m.c.y + m.b.z * m.c.z;
+
+	if (aa == 0.0f || bb == 0.0f || cc == 0.0f) return MAT4_CLASS_GENERAL;
+	if (ab * ab > eps * eps * aa * bb || ac * ac > eps * eps * aa * cc
+			|| bc * bc > eps * eps * bb * cc) return MAT4_CLASS_GENERAL;
+	if (fabsf(aa - bb) > eps * aa || fabsf(aa - cc) > eps * aa) return MAT4_CLASS_SCALED;
+	if (fabsf(aa - 1.0f) > eps) return MAT4_CLASS_UNIFORM;
+	return MAT4_CLASS_RIGID;
+}
+
+/* inverse of a matrix of any class but MAT4_CLASS_GENERAL: with orthogonal
+ * columns the inverse of the upper 3x3 is its transpose with the rows
+ * divided by the squared column lengths */
+static inline Mat4 mat4_invert_orthogonal(const Mat4 m) {
+	Mat4 r;
+	float ia = 1.0f / (m.a.x * m.a.x + m.a.y * m.a.y + m.a.z * m.a.z);
+	float ib = 1.0f / (m.b.x * m.b.x + m.b.y * m.b.y + m.b.z * m.b.z);
+	float ic = 1.0f / (m.c.x * m.c.x + m.c.y * m.c.y + m.c.z * m.c.z);
+
+	r.a = (Vec4){ m.a.x * ia, m.b.x * ib, m.c.x * ic, 0.0f };
+	r.b = (Vec4){ m.a.y * ia, m.b.y * ib, m.c.y * ic, 0.0f };
+	r.c = (Vec4){ m.a.z * ia, m.b.z * ib, m.c.z * ic, 0.0f };
+	r.d.x = -(m.a.x * m.d.x + m.a.y * m.d.y + m.a.z * m.d.z) * ia;
+	r.d.y = -(m.b.x * m.d.x + m.b.y * m.d.y + m.b.z * m.d.z) * ib;
+	r.d.z = -(m.c.x * m.d.x + m.c.y * m.d.y + m.c.z * m.d.z) * ic;
+	r.d.w = 1.0f;
+	return r;
+}
+
+/* Extract the six clipping planes (left, right, bottom, top, near, far)
+ * of the view frustum from a projection * view matrix (-w <= z <= w clip
+ * space). Plane normals point inside the frustum and are normalized, so
+ * vec4 dot (x, y, z, 1) gives the signed distance of a point.
+ */
+static inline void mat4_frustum_planes(Vec4 planes[6], const Mat4 m) {
+	int i;
+	Vec4 r0 = { m.a.x, m.b.x, m.c.x, m.d.x };
+	Vec4 r1 = { m.a.y, m.b.y, m.c.y, m.d.y };
+	Vec4 r2 = { m.a.z, m.b.z, m.c.z, m.d.z };
+	Vec4 r3 = { m.a.w, m.b.w, m.c.w, m.d.w };
+
+	planes[0] = vec4_add(r3, r0);
+	planes[1] = vec4_sub(r3, r0);
+	planes[2] = vec4_add(r3, r1);
+	planes[3] = vec4_sub(r3, r1);
+	planes[4] = vec4_add(r3, r2);
+	planes[5] = vec4_sub(r3, r2);
+
+	for(i = 0; i < 6; i++) {
+		float len = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+		planes[i] = vec4_scale(planes[i], 1.0f / len);
+	}
+}
+
+/* check if an axis-aligned box is (at least partially) inside the frustum
+ * planes; the planes do not need to be normalized */
+static inline int frustum_aabb_visible(const Vec4 planes[6], const Vec3 min, const Vec3 max) {
+	int i;
+	for(i = 0; i < 6; i++) {
+		/* the box corner farthest along the plane normal */
+		float x = planes[i].x > 0 ? max.x : min.x;
+		float y = planes[i].y > 0 ? max.y : min.y;
+		float z = planes[i].z > 0 ? max.z : min.z;
+		if (planes[i].x * x + planes[i].y * y + planes[i].z * z + planes[i].w < 0) return 0;
+	}
+	return 1;
+}
+
+/* check if a sphere is (at least partially) inside the frustum planes */
+static inline int frustum_sphere_visible(const Vec4 planes[6], const Vec3 center, float radius) {
+	int i;
+	for(i = 0; i < 6; i++) {
+		float d = planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w;
+		if (d < -radius) return 0;
+	}
+	return 1;
+}
+
+/* batch transform kernel, vectorized across groups of four objects: lane j
+ * of each vector holds a matrix element of object j of the group */
+#define MAT4_BATCH_WIDTH 4
+typedef float mat4_lanes __attribute__((vector_size(MAT4_BATCH_WIDTH * sizeof(float))));
+
+/* 4x4 transpose of the lanes, converts between a column of four matrices and
+ * the lane vectors of its elements */
+static inline void mat4_lanes_transpose(mat4_lanes * r) {
+#if defined(LINALG_SSE)
+	__m128 r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	r[0] = r0; r[1] = r1; r[2] = r2; r[3] = r3;
+#elif defined(LINALG_NEON)
+	float32x4x2_t t01 = vtrnq_f32((float32x4_t)r[0], (float32x4_t)r[1]);
+	float32x4x2_t t23 = vtrnq_f32((float32x4_t)r[2], (float32x4_t)r[3]);
+	r[0] = (mat4_lanes)vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	r[1] = (mat4_lanes)vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	r[2] = (mat4_lanes)vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r[3] = (mat4_lanes)vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+#else
+	mat4_lanes t[4] = { r[0], r[1], r[2], r[3] };
+	int i, j;
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			r[i][j] = t[j][i];
+#endif
+}
+
+/* the product of lane matrices a * b, for an affine b: the w of the first
+ * three columns of b is 0, of the last one 1, so those terms are skipped;
+ * the rest accumulates in the same order as mat4_mul_scalar() */
+static inline void mat4_lanes_mul_dir(mat4_lanes * out, const mat4_lanes * a, const mat4_lanes * b) {
+	out[0] = a[0] * b[0] + a[4] * b[1] + a[8] * b[2];
+	out[1] = a[1] * b[0] + a[5] * b[1] + a[9] * b[2];
+	out[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2];
+	out[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2];
+}
+static inline void mat4_lanes_mul_point(mat4_lanes * out, const mat4_lanes * a, const mat4_lanes * b) {
+	out[0] = a[0] * b[0] + a[4] * b[1] + a[8] * b[2] + a[12];
+	out[1] = a[1] * b[0] + a[5] * b[1] + a[9] * b[2] + a[13];
+	out[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2] + a[14];
+	out[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2] + a[15];
+}
+static inline void mat4_lanes_mul_affine(mat4_lanes * out, const mat4_lanes * a, const mat4_lanes * b) {
+	mat4_lanes_mul_dir(&out[0], a, &b[0]);
+	mat4_lanes_mul_dir(&out[4], a, &b[4]);
+	mat4_lanes_mul_dir(&out[8], a, &b[8]);
+	mat4_lanes_mul_point(&out[12], a, &b[12]);
+}
+
+/* compute the instance matrices of n objects with the model matrices m:
+ *   mv = v * m[i]
+ *   mvp = p * mv
+ *   normal = the transposed inverse of the mv upper 3x3 (the rest is identity)
+ * The three matrices are written, in this order, to the record out_index[i]
+ * (or i, when out_index is NULL) of out, records are out_stride bytes long.
+ * All the model matrices must be of the class cls, or a more specific one,
+ * the view matrix must be rigid.
+ */
+static inline void mat4_batch_instances(const Mat4 * m, const uint32_t * out_index, uint32_t n,
+		enum mat4_class cls, const Mat4 v, const Mat4 p, void * out, size_t out_stride) {
+
+	const float * vf = (const float *)&v;
+	const float * pf = (const float *)&p;
+	mat4_lanes V[16], P[16];
+	uint32_t base, count, j;
+	int c, k;
+
+	/* broadcast once, not for every multiplication */
+	for (k = 0; k < 16; k++) {
+		V[k] = (mat4_lanes){ 0.0f } + vf[k];
+		P[k] = (mat4_lanes){ 0.0f } + pf[k];
+	}
+
+	for (base = 0; base < n; base += MAT4_BATCH_WIDTH) {
+		mat4_lanes M[16], MV[16], MVP[16], N[16];
+
+		count = n - base;
+		if (count > MAT4_BATCH_WIDTH) count = MAT4_BATCH_WIDTH;
+
+		/* gather, unused lanes repeat the first object */
+		for (j = 0; j < MAT4_BATCH_WIDTH; j++) {
+			const Mat4 * src = &m[base + (j < count ? j : 0)];
+			memcpy(&M[j], &src->a, sizeof(Vec4));
+			memcpy(&M[4 + j], &src->b, sizeof(Vec4));
+			memcpy(&M[8 + j], &src->c, sizeof(Vec4));
+			memcpy(&M[12 + j], &src->d, sizeof(Vec4));
+		}
+		mat4_lanes_transpose(&M[0]);
+		mat4_lanes_transpose(&M[4]);
+		mat4_lanes_transpose(&M[8]);
+		mat4_lanes_transpose(&M[12]);
+
+		/* the view matrix is affine too, so is mv */
+		mat4_lanes_mul_affine(MV, V, M);
+		mat4_lanes_mul_affine(MVP, P, MV);
+
+		mat4_lanes * A = &MV[0], * B = &MV[4], * C = &MV[8];
+		mat4_lanes ia, ib, ic, zero = { 0.0f };
+		switch (cls) {
+		case MAT4_CLASS_RIGID:
+			/* orthonormal, the transposed inverse is the matrix itself */
+			ia = ib = ic = zero + 1.0f;
+			break;
+		case MAT4_CLASS_UNIFORM:
+			ia = ib = ic = 1.0f / (A[0] * A[0] + A[1] * A[1] + A[2] * A[2]);
+			break;
+		case MAT4_CLASS_SCALED:
+			/* orthogonal columns, divided by their squared lengths */
+			ia = 1.0f / (A[0] * A[0] + A[1] * A[1] + A[2] * A[2]);
+			ib = 1.0f / (B[0] * B[0] + B[1] * B[1] + B[2] * B[2]);
+			ic = 1.0f / (C[0] * C[0] + C[1] * C[1] + C[2] * C[2]);
+			break;
+		default:
+			/* for columns a, b, c the transposed inverse has columns
+			 * b x c, c x a, a x b divided by the determinant a . (b x c) */
+			N[0] = B[1] * C[2] - B[2] * C[1];
+			N[1] = B[2] * C[0] - B[0] * C[2];
+			N[2] = B[0] * C[1] - B[1] * C[0];
+			N[4] = C[1] * A[2] - C[2] * A[1];
+			N[5] = C[2] * A[0] - C[0] * A[2];
+			N[6] = C[0] * A[1] - C[1] * A[0];
+			N[8] = A[1] * B[2] - A[2] * B[1];
+			N[9] = A[2] * B[0] - A[0] * B[2];
+			N[10] = A[0] * B[1] - A[1] * B[0];
+			ia = ib = ic = 1.0f / (A[0] * N[0] + A[1] * N[1] + A[2] * N[2]);
+			A = &N[0]; B = &N[4]; C = &N[8];
+			break;
+		}
+		N[0] = A[0] * ia; N[1] = A[1] * ia; N[2] = A[2] * ia; N[3] = zero;
+		N[4] = B[0] * ib; N[5] = B[1] * ib; N[6] = B[2] * ib; N[7] = zero;
+		N[8] = C[0] * ic; N[9] = C[1] * ic; N[10] = C[2] * ic; N[11] = zero;
+		N[12] = zero; N[13] = zero; N[14] = zero; N[15] = zero + 1.0f;
+
+		/* scatter, the transposes turn the lanes back to matrix columns */
+		for (k = 0; k < 16; k += 4) {
+			mat4_lanes_transpose(&MV[k]);
+			mat4_lanes_transpose(&MVP[k]);
+			mat4_lanes_transpose(&N[k]);
+		}
+		for (j = 0; j < count; j++) {
+			uint32_t idx = out_index ? out_index[base + j] : base + j;
+			float * dst = (float *)((unsigned char *)out + idx * out_stride);
+			for (c = 0; c < 4; c++) {
+				memcpy(dst + c * 4, &MV[c * 4 + j], sizeof(Vec4));
+				memcpy(dst + 16 + c * 4, &MVP[c * 4 + j], sizeof(Vec4));
+				memcpy(dst + 32 + c * 4, &N[c * 4 + j], sizeof(Vec4));
+			}
+		}
+	}
+}
+
 #endif
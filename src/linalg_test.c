@@ -225,7 +225,7 @@ void test_mat4(void) {
 	memset(r, 0, sizeof(mat4x4));
 	memset(&R, 0, sizeof(Mat4));
 	mat4x4_transpose(r, a);
-	R = mat4_transpose(A);
+	R = mat4_transpose_scalar(A);
 	CHECK(r, R, "mat4_transpose");
 
 	memset(r, 0, sizeof(mat4x4));
@@ -249,7 +249,7 @@ void test_mat4(void) {
 	memset(r, 0, sizeof(mat4x4));
 	memset(&R, 0, sizeof(Mat4));
 	mat4x4_mul(r, a, b);
-	R = mat4_mul(A, B);
+	R = mat4_mul_scalar(A, B);
 	CHECK(r, R, "mat4_mul");
 
 	memset(r, 0, sizeof(mat4x4));
@@ -261,7 +261,7 @@ void test_mat4(void) {
 	memset(r, 0, sizeof(mat4x4));
 	memset(&R, 0, sizeof(Mat4));
 	mat4x4_mul_vec4(vr, a, v);
-	VR = mat4_mul_vec4(A, V);
+	VR = mat4_mul_vec4_scalar(A, V);
 	CHECK(vr, VR, "mat4_mul_vec4");
 
 	memset(r, 0, sizeof(mat4x4));
@@ -309,7 +309,7 @@ void test_mat4(void) {
 	memset(r, 0, sizeof(mat4x4));
 	memset(&R, 0, sizeof(Mat4));
 	mat4x4_invert(r, a);
-	R = mat4_invert(A);
+	R = mat4_invert_scalar(A);
 	CHECK(r, R, "mat4_invert");
 
 	memset(r, 0, sizeof(mat4x4));
@@ -343,6 +343,185 @@ void test_mat4(void) {
 	CHECK(r, R, "mat4_look_at"); */
 }
 
+#define SIMD_EPSILON (1e-5f)
+
+static float rand_float(void) {
+	return (float)rand() / RAND_MAX * 20.0f - 10.0f;
+}
+
+static Mat4 rand_mat4(void) {
+	Mat4 m;
+	float * M = (float *)&m;
+	int i;
+	for(i = 0; i < 16; i++) M[i] = rand_float();
+	return m;
+}
+
+/* relative difference, so it works for big elements of the inverses too */
+static void check_close(const float * r, const float * R, int n, const char * msg) {
+	int i;
+	for(i = 0; i < n; i++) {
+		float scale = fabsf(R[i]) > 1.0f ? fabsf(R[i]) : 1.0f;
+		if (fabsf(r[i] - R[i]) > SIMD_EPSILON * scale) {
+			fprintf(stderr, "FAIL: %s (element %i: %g != %g)\n", msg, i, r[i], R[i]);
+			abort();
+		}
+	}
+}
+
+/* the SIMD implementations must match the scalar ones */
+void test_mat4_simd(void) {
+
+	int i;
+
+	printf("SIMD implementation: %s\n", LINALG_SIMD_NAME);
+
+	srand(1);
+	for(i = 0; i < 1000; i++) {
+		Mat4 A = rand_mat4(), B = rand_mat4();
+		Vec4 V = { rand_float(), rand_float(), rand_float(), rand_float() };
+		Mat4 R, R_scalar;
+		Vec4 VR, VR_scalar;
+
+		R = mat4_transpose(A);
+		R_scalar = mat4_transpose_scalar(A);
+		CHECK(&R, R_scalar, "mat4_transpose SIMD");
+
+		R = mat4_mul(A, B);
+		R_scalar = mat4_mul_scalar(A, B);
+		check_close((float *)&R, (float *)&R_scalar, 16, "mat4_mul SIMD");
+
+		VR = mat4_mul_vec4(A, V);
+		VR_scalar = mat4_mul_vec4_scalar(A, V);
+		check_close((float *)&VR, (float *)&VR_scalar, 4, "mat4_mul_vec4 SIMD");
+
+		/* keep it well-conditioned, the two methods round differently */
+		A.a.x += 40.0f; A.b.y += 40.0f; A.c.z += 40.0f; A.d.w += 40.0f;
+		R = mat4_invert(A);
+		R_scalar = mat4_invert_scalar(A);
+		check_close((float *)&R, (float *)&R_scalar, 16, "mat4_invert SIMD");
+	}
+
+	/* a typical model-view matrix */
+	Vec3 eye = {3, 4, 5}, dir = {-1, -1, -2}, up = {0, 1, 0};
+	Mat4 mv = mat4_mul(mat4_view(eye, dir, up), mat4_rotate_Y(mat4_translate(1, 2, 3), 0.7f));
+	Mat4 R = mat4_invert(mv), R_scalar = mat4_invert_scalar(mv);
+	check_close((float *)&R, (float *)&R_scalar, 16, "mat4_invert SIMD (model-view)");
+	R = mat4_mul(mv, R);
+	check_close((float *)&R, (float *)&MAT4_IDENTITY, 16, "mat4_invert SIMD (identity)");
+}
+
+static void check_batch(const Mat4 * models, const uint32_t * out_index, int n,
+		const Mat4 v, const Mat4 p, Mat4 (*out)[3]) {
+
+	int i, c;
+
+	for(i = 0; i < n; i++) {
+		Mat4 mv = mat4_mul_scalar(v, models[i]);
+		Mat4 mvp = mat4_mul_scalar(p, mv);
+		Mat4 normal = mat4_transpose_scalar(mat4_invert_scalar(mv));
+		Mat4 * o = out[out_index[i]];
+
+		check_close((float *)&o[0], (float *)&mv, 16, "mat4_batch_instances mv");
+		check_close((float *)&o[1], (float *)&mvp, 16, "mat4_batch_instances mvp");
+		/* only the upper 3x3 of the normal matrix is defined */
+		for(c = 0; c < 3; c++) {
+			check_close((float *)&o[2] + c * 4, (float *)&normal + c * 4, 3, "mat4_batch_instances normal");
+		}
+	}
+}
+
+void test_mat4_batch(void) {
+
+	Mat4 models[7];
+	uint32_t out_index[7] = { 3, 0, 6, 1, 5, 2, 4 };
+	Mat4 out[7][3];
+	Vec3 eye = {3, 4, 5}, dir = {-1, -1, -2}, up = {0, 1, 0};
+	Mat4 v = mat4_view(eye, dir, up);
+	Mat4 p = mat4_perspective(1, 2, 3, 4);
+	int i;
+
+	srand(2);
+	for(i = 0; i < 7; i++) {
+		models[i] = mat4_rotate(mat4_translate(rand_float(), rand_float(), rand_float()),
+				rand_float(), rand_float(), rand_float(), rand_float());
+		models[i] = mat4_scale_aniso(models[i], 1.0f + i, 2.0f, 0.5f);
+		models[i].b.x += 0.5f; /* skew */
+	}
+
+	/* 7 objects: a full group and a partial one */
+	mat4_batch_instances(models, out_index, 7, MAT4_CLASS_GENERAL, v, p, out, sizeof(out[0]));
+	check_batch(models, out_index, 7, v, p, out);
+
+	/* the cheap normal matrix paths */
+	for(i = 0; i < 7; i++) {
+		models[i] = mat4_rotate(mat4_translate(rand_float(), rand_float(), rand_float()),
+				rand_float(), rand_float(), rand_float(), rand_float());
+	}
+	mat4_batch_instances(models, out_index, 7, MAT4_CLASS_RIGID, v, p, out, sizeof(out[0]));
+	check_batch(models, out_index, 7, v, p, out);
+	for(i = 0; i < 7; i++) models[i] = mat4_scale_aniso(models[i], 0.5f + i, 0.5f + i, 0.5f + i);
+	mat4_batch_instances(models, out_index, 7, MAT4_CLASS_UNIFORM, v, p, out, sizeof(out[0]));
+	check_batch(models, out_index, 7, v, p, out);
+	for(i = 0; i < 7; i++) models[i] = mat4_scale_aniso(models[i], 1.0f, 3.0f, 0.25f);
+	mat4_batch_instances(models, out_index, 7, MAT4_CLASS_SCALED, v, p, out, sizeof(out[0]));
+	check_batch(models, out_index, 7, v, p, out);
+}
+
+void test_mat4_class(void) {
+
+	Mat4 r = mat4_rotate(mat4_translate(1, 2, 3), 1, 2, 3, 0.5f);
+	Mat4 m;
+
+	if (mat4_classify(MAT4_IDENTITY) != MAT4_CLASS_RIGID || mat4_classify(r) != MAT4_CLASS_RIGID) {
+		fprintf(stderr, "FAIL: mat4_classify (rigid)\n"); abort();
+	}
+	if (mat4_classify(mat4_scale_aniso(r, 2, 2, 2)) != MAT4_CLASS_UNIFORM) {
+		fprintf(stderr, "FAIL: mat4_classify (uniform)\n"); abort();
+	}
+	m = mat4_scale_aniso(r, 1, 2, 3);
+	if (mat4_classify(m) != MAT4_CLASS_SCALED) {
+		fprintf(stderr, "FAIL: mat4_classify (scaled)\n"); abort();
+	}
+	Mat4 im = mat4_invert_orthogonal(m), im_general = mat4_invert_scalar(m);
+	check_close((float *)&im, (float *)&im_general, 16, "mat4_invert_orthogonal");
+
+	/* scaled after the rotation - skewed */
+	m = mat4_mul(mat4_scale_aniso(MAT4_IDENTITY, 1, 2, 3), r);
+	if (mat4_classify(m) != MAT4_CLASS_GENERAL) {
+		fprintf(stderr, "FAIL: mat4_classify (general)\n"); abort();
+	}
+	if (mat4_classify(mat4_perspective(1, 2, 3, 4)) != MAT4_CLASS_GENERAL) {
+		fprintf(stderr, "FAIL: mat4_classify (projection)\n"); abort();
+	}
+}
+
+void test_frustum(void) {
+
+	Vec4 planes[6];
+	Vec3 eye = {0, 0, 0}, dir = {0, 0, -1}, up = {0, 1, 0};
+	Mat4 p = mat4_perspective(deg_to_rad(90.0f), 1.0f, 1.0f, 100.0f);
+	Mat4 v = mat4_view(eye, dir, up);
+
+	mat4_frustum_planes(planes, mat4_mul(p, v));
+
+	if (!frustum_sphere_visible(planes, (Vec3){0, 0, -10}, 0.5f)) {
+		fprintf(stderr, "FAIL: frustum_sphere_visible (inside)\n"); abort();
+	}
+	if (frustum_sphere_visible(planes, (Vec3){0, 0, 10}, 0.5f)) {
+		fprintf(stderr, "FAIL: frustum_sphere_visible (behind)\n"); abort();
+	}
+	if (frustum_sphere_visible(planes, (Vec3){0, 0, -200}, 50.0f)) {
+		fprintf(stderr, "FAIL: frustum_sphere_visible (beyond far)\n"); abort();
+	}
+	if (frustum_sphere_visible(planes, (Vec3){-20, 0, -10}, 5.0f)) {
+		fprintf(stderr, "FAIL: frustum_sphere_visible (left)\n"); abort();
+	}
+	if (!frustum_sphere_visible(planes, (Vec3){-12, 0, -10}, 5.0f)) {
+		fprintf(stderr, "FAIL: frustum_sphere_visible (crossing left)\n"); abort();
+	}
+}
+
 int main(int argc, char ** argv) {
 
 	printf("Testing linalg.h...\n");
@@ -371,6 +550,10 @@ int main(int argc, char ** argv) {
 	test_vec3();
 	test_vec4();
 	test_mat4();
+	test_mat4_simd();
+	test_mat4_batch();
+	test_mat4_class();
+	test_frustum();
 
 	printf("passed!\n");
 }
@@ -14,6 +14,8 @@
 #include "linalg.h"
 #include "world.h"
 
+#include "platform/plat_headless.h"
+
 #ifdef HAVE_XCB
 #include "platform/plat_xcb.h"
 #endif
@@ -32,6 +34,17 @@ struct options options = {
 	.win_height = 500,
 	.stats = false,
 	.fps_cap = false,
+	.headless = false,
+	.frames = 0,
+	.frame_lag = 2,
+	.host_meshes = false,
+	.pipeline_cache = true,
+	.shared_terrain = false,
+	.gpu_cull = false,
+	.threads = 0,
+	.record_bench = false,
+	.extrapolate = false,
+	.tick_rate = 20.0f,
 };
 
 void request_exit(void) {
@@ -60,11 +73,28 @@ void usage(FILE *fp, const char *name) {
 "    --help, -h                this message\n"
 "    --fullscreen, -f          full-screen mode\n"
 "    --vsync=MODE, -v MODE     presentation (vsync) mode.\n"
-"    --stats, -s               show pipeline statistics\n"
+"    --stats, -s               show pipeline statistics (with --threads only\n"
+"                              when the device supports inherited queries)\n"
 "    --width=VALUE, -W VALUE   window width\n"
 "    --height=VALUE, -H VALUE  window height\n"
 "    --fps-cap=VALUE, -c VALUE FPS cap\n"
-"\n", name);
+"    --headless                render offscreen, without a window\n"
+"    --frames=VALUE, -n VALUE  exit after rendering VALUE frames\n"
+"    --frame-lag=VALUE, -l VALUE\n"
+"                              number of frames in flight (1-%i)\n"
+"    --host-meshes             keep mesh data in host-visible memory\n"
+"    --no-pipeline-cache       do not load or save the pipeline cache\n"
+"    --shared-terrain          terrain mesh with shared vertices, faceted\n"
+"                              shading derived in the fragment shader\n"
+"    --gpu-cull                frustum and LOD culling in a compute shader\n"
+"    --threads=VALUE, -t VALUE record the draws on VALUE threads (1-%i),\n"
+"                              0: on the render thread\n"
+"    --record-bench            time the draw recording with 1 to --threads\n"
+"                              threads on the first frame, then exit\n"
+"    --extrapolate             extrapolate the view from the last world tick\n"
+"                              instead of interpolating one tick behind\n"
+"    --tick-rate=VALUE         world updates per second (default: 20)\n"
+"\n", name, FRAME_LAG_MAX, RECORD_THREADS_MAX);
 }
 
 void parse_args(int argc, char **argv) {
@@ -138,6 +168,63 @@ void parse_args(int argc, char **argv) {
 			if (val <= 0) break;
 			options.fps_cap = val;
 		}
+		else if (!strcmp(opt, "--headless")) {
+			options.headless = true;
+		}
+		else if (!strcmp(opt, "-n") || !strcmp(opt, "--frames")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			int val = atoi(arg);
+			if (val <= 0) break;
+			options.frames = val;
+		}
+		else if (!strcmp(opt, "--shared-terrain")) {
+			options.shared_terrain = true;
+		}
+		else if (!strcmp(opt, "--gpu-cull")) {
+			options.gpu_cull = true;
+		}
+		else if (!strcmp(opt, "-t") || !strcmp(opt, "--threads")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			int val = atoi(arg);
+			if (val < 0 || val > RECORD_THREADS_MAX) break;
+			options.threads = val;
+		}
+		else if (!strcmp(opt, "--record-bench")) {
+			options.record_bench = true;
+		}
+		else if (!strcmp(opt, "--extrapolate")) {
+			options.extrapolate = true;
+		}
+		else if (!strcmp(opt, "--tick-rate")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			float val = atof(arg);
+			if (val <= 0) break;
+			options.tick_rate = val;
+		}
+		else if (!strcmp(opt, "--no-pipeline-cache")) {
+			options.pipeline_cache = false;
+		}
+		else if (!strcmp(opt, "--host-meshes")) {
+			options.host_meshes = true;
+		}
+		else if (!strcmp(opt, "-l") || !strcmp(opt, "--frame-lag")) {
+			if (!arg) {
+				if (i < argc - 1) arg = argv[++i];
+				else break;
+			}
+			int val = atoi(arg);
+			if (val <= 0 || val > FRAME_LAG_MAX) break;
+			options.frame_lag = val;
+		}
 		else break;
 	}
 	if (i < argc) {
@@ -146,6 +233,10 @@ void parse_args(int argc, char **argv) {
 		usage(stderr, argv[0]);
 		exit(1);
 	}
+	if (options.record_bench && !options.threads) {
+		fprintf(stderr, "--record-bench needs --threads\n");
+		exit(1);
+	}
 }
 
 int main(int argc, char **argv) {
@@ -176,6 +267,9 @@ int main(int argc, char **argv) {
 		goto finish;
 	}
 
+	if (options.headless) {
+		surf = plat_headless_get_surface();
+	}
 #ifdef HAVE_XCB
 	if (!surf) surf = plat_xcb_get_surface();
 #endif
@@ -184,7 +278,7 @@ int main(int argc, char **argv) {
 #endif
 
 	if (!surf) {
-		printf("Failed to create presentation surface.\n");
+		printf("Failed to create presentation surface (try --headless).\n");
 		goto finish;
 	}
 
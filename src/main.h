@@ -10,6 +10,17 @@ extern struct options {
 	bool polygon_mode;
 	bool stats;
 	float fps_cap;
+	bool headless;
+	uint32_t frames;
+	uint32_t frame_lag;
+	bool host_meshes;
+	bool pipeline_cache;
+	bool shared_terrain;
+	bool gpu_cull;
+	uint32_t threads;
+	bool record_bench;
+	bool extrapolate;
+	float tick_rate;
 
 	uint32_t win_width;
 	uint32_t win_height;
@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 void destroy_model(struct model * model) {
 
@@ -10,6 +11,8 @@ void destroy_model(struct model * model) {
 	}
 	if (model->vertices) free(model->vertices);
 	if (model->indices) free(model->indices);
+	if (model->chunks) free(model->chunks);
+	if (model->lod_nodes) free(model->lod_nodes);
 }
 
 Vec4 triangle_normal(Vec4 a, Vec4 b, Vec4 c) {
@@ -46,3 +49,126 @@ void model_compute_normals(struct model * model) {
 		verts[i + 2].normal = verts[i].normal;
 	}
 }
+
+void model_compute_bounds(struct model * model) {
+
+	uint32_t i;
+	Vec3 min, max;
+	float radius2 = 0.0f;
+
+	if (!model->vertices_len) {
+		model->bounds_center = (Vec3){ 0.0f, 0.0f, 0.0f };
+		model->bounds_radius = 0.0f;
+		return;
+	}
+
+	// center of the axis-aligned bounding box...
+	min.x = max.x = model->vertices[0].pos.x;
+	min.y = max.y = model->vertices[0].pos.y;
+	min.z = max.z = model->vertices[0].pos.z;
+	for(i = 1; i < model->vertices_len; i++) {
+		Vec4 p = model->vertices[i].pos;
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.z < min.z) min.z = p.z;
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+		if (p.z > max.z) max.z = p.z;
+	}
+	model->bounds_center = vec3_scale(vec3_add(min, max), 0.5f);
+
+	// ...and distance to the farthest vertex
+	for(i = 0; i < model->vertices_len; i++) {
+		Vec4 p = model->vertices[i].pos;
+		Vec3 d = vec3_sub((Vec3){ p.x, p.y, p.z }, model->bounds_center);
+		float l2 = vec3_mul_inner(d, d);
+		if (l2 > radius2) radius2 = l2;
+	}
+	model->bounds_radius = sqrtf(radius2);
+}
+
+void model_compute_chunk_bounds(struct model * model, struct model_chunk * chunk) {
+
+	uint32_t i;
+	Vec3 min = { INFINITY, INFINITY, INFINITY };
+	Vec3 max = { -INFINITY, -INFINITY, -INFINITY };
+
+	for(i = chunk->index_offset; i < chunk->index_offset + chunk->index_count; i++) {
+		Vec4 p = model->vertices[model->indices[i]].pos;
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.z < min.z) min.z = p.z;
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+		if (p.z > max.z) max.z = p.z;
+	}
+	chunk->bounds_min = min;
+	chunk->bounds_max = max;
+}
+
+static inline int16_t to_snorm16(float v) {
+
+	if (v > 1.0f) v = 1.0f;
+	else if (v < -1.0f) v = -1.0f;
+	return (int16_t)lrintf(v * 32767.0f);
+}
+
+/* octahedral encoding of a normal vector */
+static void oct_encode(Vec4 n, int16_t * out) {
+
+	float len = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float x, y;
+
+	if (len == 0.0f) {
+		out[0] = out[1] = 0; // decodes to +z
+		return;
+	}
+	x = n.x / len;
+	y = n.y / len;
+	if (n.z < 0.0f) {
+		float ox = x;
+		x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+	out[0] = to_snorm16(x);
+	out[1] = to_snorm16(y);
+}
+
+void model_pack_vertices(const struct model * model, struct packed_vertex * dst, Vec3 * offset, Vec3 * scale) {
+
+	uint32_t i;
+	Vec3 min = { INFINITY, INFINITY, INFINITY };
+	Vec3 max = { -INFINITY, -INFINITY, -INFINITY };
+
+	for(i = 0; i < model->vertices_len; i++) {
+		Vec4 p = model->vertices[i].pos;
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.z < min.z) min.z = p.z;
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+		if (p.z > max.z) max.z = p.z;
+	}
+	if (!model->vertices_len) {
+		min = (Vec3){ 0.0f, 0.0f, 0.0f };
+		max = min;
+	}
+
+	*offset = vec3_scale(vec3_add(min, max), 0.5f);
+	*scale = vec3_scale(vec3_sub(max, min), 0.5f);
+	// flat dimensions would divide by zero, any scale works for them
+	if (scale->x == 0.0f) scale->x = 1.0f;
+	if (scale->y == 0.0f) scale->y = 1.0f;
+	if (scale->z == 0.0f) scale->z = 1.0f;
+
+	for(i = 0; i < model->vertices_len; i++) {
+		const struct vertex_data * v = &model->vertices[i];
+		dst[i].pos[0] = to_snorm16((v->pos.x - offset->x) / scale->x);
+		dst[i].pos[1] = to_snorm16((v->pos.y - offset->y) / scale->y);
+		dst[i].pos[2] = to_snorm16((v->pos.z - offset->z) / scale->z);
+		dst[i].pos[3] = 32767;
+		Vec4 n = { v->normal.x * scale->x, v->normal.y * scale->y, v->normal.z * scale->z, 0.0f };
+		oct_encode(n, dst[i].normal);
+		dst[i].material_flags = PACK_MATERIAL_FLAGS(v->material, v->flags);
+	}
+}
@@ -5,6 +5,9 @@
 #include <stdint.h>
 
 #define V_FLAG_FLAT 1
+/* face normal derived from the surface in the fragment shader,
+ * for meshes with vertices shared between faces */
+#define V_FLAG_FACETED 2
 
 struct vertex_data {
 	Vec4 pos;
@@ -12,8 +15,46 @@ struct vertex_data {
 	uint32_t material, flags, pad1, pad2;
 };
 
+/* compact vertex format used in the GPU buffers
+ *
+ * pos is snorm16, relative to the model's bounding box: the real position is
+ * offset + pos * scale, as returned by model_pack_vertices(); w is always 1.0
+ * normal is a snorm16 octahedral encoding of the unit normal multiplied by
+ * scale, so the normal matrix of the dequantizing transform gives the right
+ * direction
+ */
+struct packed_vertex {
+	int16_t pos[4];
+	int16_t normal[2];
+	uint32_t material_flags; /* material in the low 16 bits, flags in the high ones */
+};
+
+#define PACK_MATERIAL_FLAGS(material, flags) (((material) & 0xffff) | ((flags) << 16))
+
 struct model;
 
+/* a part of an indexed model which can be culled and drawn separately */
+struct model_chunk {
+	/* range of model->indices */
+	uint32_t index_offset;
+	uint32_t index_count;
+
+	/* axis-aligned bounding box, in model coordinates */
+	Vec3 bounds_min, bounds_max;
+};
+
+#define MODEL_LOD_NONE UINT32_MAX
+
+/* node of a level of detail quadtree over model chunks */
+struct model_lod_node {
+	/* chunk drawn when this node is selected */
+	uint32_t chunk;
+	/* finer nodes covering the same area, MODEL_LOD_NONE when missing */
+	uint32_t children[4];
+	/* the children are used when the eye is closer than this to the chunk box */
+	float split_distance;
+};
+
 struct model_type {
 	const char * name;
 
@@ -33,6 +74,20 @@ struct model {
 
 	/* total number of triangles to draw */
 	uint32_t triangles;
+
+	/* bounding sphere, in model coordinates */
+	Vec3 bounds_center;
+	float bounds_radius;
+
+	/* optional split of the indices into separately culled chunks */
+	struct model_chunk * chunks;
+	uint32_t chunks_len;
+
+	/* optional LOD quadtree; when present, only chunks selected
+	 * by traversing it from lod_root are drawn */
+	struct model_lod_node * lod_nodes;
+	uint32_t lod_nodes_len;
+	uint32_t lod_root;
 };
 
 void destroy_model(struct model * model);
@@ -43,4 +98,14 @@ Vec4 triangle_normal(Vec4 a, Vec4 b, Vec4 c);
 // compute normals for flat surfaces
 void model_compute_normals(struct model * model);
 
+// compute the bounding sphere, to be called when the vertices are ready
+void model_compute_bounds(struct model * model);
+
+// convert the model vertices to the packed format; offset and scale are set
+// to the transformation from the packed positions to model coordinates
+void model_pack_vertices(const struct model * model, struct packed_vertex * dst, Vec3 * offset, Vec3 * scale);
+
+// compute the bounding box of a chunk, from the vertices it references
+void model_compute_chunk_bounds(struct model * model, struct model_chunk * chunk);
+
 #endif
@@ -38,6 +38,8 @@ struct model * create_plane(uint32_t material) {
 	model->vertices_len = VERT_COUNT;
 	model->triangles = TRIANGLE_COUNT;
 
+	model_compute_bounds(model);
+
 	return model;
 }
 
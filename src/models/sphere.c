@@ -84,6 +84,8 @@ struct model * create_sphere(uint32_t material, int detail, float radius) {
 	}
 	sphere->model.indices_len = ind;
 
+	model_compute_bounds(&sphere->model);
+
 	return (struct model *)sphere;
 }
 
@@ -5,82 +5,353 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdbool.h>
 
 #include "materials.h"
+#include "heightmap.h"
 
 struct terrain_model {
 	struct model model;
 
 	uint32_t width, depth;
-	float heightmap[];
+	struct heightmap * heightmap;
+
+	/* one vertex per grid point, V_FLAG_FACETED shading */
+	bool shared_vertices;
 };
 
 static const float x_step = 2.0f, y_step = 1.0f, z_step = 2.0f;
 
-struct model * create_terrain(uint32_t width, uint32_t depth, const char * heightmap_path, float sea_level) {
+/* vertex at heightmap grid point (i, j), without the normal */
+static struct vertex_data grid_vertex(struct terrain_model * terrain, int i, int j) {
+
+	struct vertex_data vd = {
+		.pos = {
+			- x_step * terrain->width / 2 + j * x_step,
+			heightmap_get(terrain->heightmap, j, terrain->depth - i - 1) * y_step,
+			- z_step * terrain->width / 2 + i * z_step,
+			1.0f
+		},
+		.flags = terrain->shared_vertices ? V_FLAG_FACETED : V_FLAG_FLAT,
+	};
+	float h = vd.pos.y / y_step;
+	if (h < TERR_GRASS_THRESHOLD) vd.material = MATERIAL_SAND;
+	else if (h < TERR_ROCK_THRESHOLD) vd.material = MATERIAL_GRASS;
+	else if (h < TERR_SNOW_THRESHOLD) vd.material = MATERIAL_ROCK;
+	else vd.material = MATERIAL_SNOW;
+	return vd;
+}
+
+/* tile of the LOD quadtree: grid points [i0, i1] x [j0, j1], every step-th */
+struct lod_tile {
+	int i0, i1, j0, j1, step;
+	float skirt; /* how deep the skirts go below the edges */
+};
+
+/* emit the two triangles of the quad between grid points (i_prev, j_prev) and (i, j) */
+static void emit_quad(struct model * model, struct terrain_model * terrain,
+				int i, int j, int i_prev, int j_prev, Vec4 * n1_out) {
+
+	struct vertex_data * verts = model->vertices + model->vertices_len;
+	uint32_t * indices = model->indices + model->indices_len;
+	uint32_t k;
+
+	/*    v4----v
+	 *    | 2 / |
+	 *    | / 1 |
+	 *    v3----v2   */
+	struct vertex_data v = grid_vertex(terrain, i, j);
+	struct vertex_data v2 = grid_vertex(terrain, i_prev, j);
+	struct vertex_data v3 = grid_vertex(terrain, i_prev, j_prev);
+	struct vertex_data v4 = grid_vertex(terrain, i, j_prev);
+
+	Vec4 n1 = triangle_normal(v.pos, v2.pos, v3.pos);
+	Vec4 n2 = triangle_normal(v.pos, v3.pos, v4.pos);
+
+	verts[0] = v;  verts[0].normal = n1;
+	verts[1] = v2; verts[1].normal = n1;
+	verts[2] = v3; verts[2].normal = n1;
+	verts[3] = v;  verts[3].normal = n2;
+	verts[4] = v3; verts[4].normal = n2;
+	verts[5] = v4; verts[5].normal = n2;
+
+	for(k = 0; k < 6; k++) indices[k] = model->vertices_len + k;
+	model->vertices_len += 6;
+	model->indices_len += 6;
+	*n1_out = n1;
+}
+
+/* emit a vertical, two-sided strip hanging from the edge (ia, ja)-(ib, jb),
+ * hiding the cracks between neighbouring tiles of different detail */
+static void emit_skirt(struct model * model, struct terrain_model * terrain,
+				int ia, int ja, int ib, int jb, float depth, Vec4 normal) {
+
+	struct vertex_data * verts = model->vertices + model->vertices_len;
+	uint32_t * indices = model->indices + model->indices_len;
+	uint32_t base = model->vertices_len;
+	uint32_t k;
+
+	verts[0] = grid_vertex(terrain, ia, ja);
+	verts[1] = grid_vertex(terrain, ib, jb);
+	verts[2] = verts[1];
+	verts[2].pos.y -= depth;
+	verts[3] = verts[0];
+	verts[3].pos.y -= depth;
+	for(k = 0; k < 4; k++) verts[k].normal = normal;
+
+	const uint32_t order[12] = { 0, 1, 2, 0, 2, 3, 0, 2, 1, 0, 3, 2 };
+	for(k = 0; k < 12; k++) indices[k] = base + order[k];
+	model->vertices_len += 4;
+	model->indices_len += 12;
+}
+
+/* shared vertex variant of build_lod_tile(): the tile grid vertices are emitted
+ * once and indexed by the quads; skirts still get their own vertices */
+static void build_shared_lod_tile(struct terrain_model * terrain, const struct lod_tile * tile) {
+
+	struct model * model = &terrain->model;
+	int rows[TERR_CHUNK_SIZE + 1], cols[TERR_CHUNK_SIZE + 1];
+	int rows_len = 0, cols_len = 0;
+	int r, c;
+	Vec4 up = { 0.0f, 1.0f, 0.0f, 0.0f };
 
-	unsigned char buf[4096];
-	FILE * fp;
+	for(r = tile->i0; r < tile->i1 + tile->step && rows_len <= TERR_CHUNK_SIZE; r += tile->step) {
+		rows[rows_len++] = r < tile->i1 ? r : tile->i1;
+	}
+	for(c = tile->j0; c < tile->j1 + tile->step && cols_len <= TERR_CHUNK_SIZE; c += tile->step) {
+		cols[cols_len++] = c < tile->j1 ? c : tile->j1;
+	}
 
-	fp = fopen(heightmap_path, "rb");
-	if (!fp) {
-		perror(heightmap_path);
-		fp = NULL;
+	uint32_t base = model->vertices_len;
+	for(r = 0; r < rows_len; r++) {
+		for(c = 0; c < cols_len; c++) {
+			struct vertex_data * vd = &model->vertices[model->vertices_len++];
+			*vd = grid_vertex(terrain, rows[r], cols[c]);
+			vd->normal = up;
+		}
 	}
 
-	struct terrain_model * terrain = (struct terrain_model *)calloc(1,
-				sizeof(struct terrain_model) + sizeof(float) * width * depth);
-	terrain->model.type = TERRAIN_MODEL;
-	terrain->width = width;
-	terrain->depth = depth;
-	int vert_count = width * depth;
-	float * heightmap = terrain->heightmap;
-
-	uint32_t b_read = 0;
-	while(fp && b_read < vert_count) {
-		uint32_t nbytes = fread(buf, sizeof(unsigned char), 4096, fp);
-		if (nbytes < 4096 && nbytes < vert_count - b_read) {
-			if (ferror(fp)) {
-				perror(heightmap_path);
-			}
-			else {
-				fprintf(stderr, "%s - unexpected EOF", heightmap_path);
+	uint32_t * indices = model->indices;
+	for(r = 1; r < rows_len; r++) {
+		for(c = 1; c < cols_len; c++) {
+			uint32_t v = base + r * cols_len + c;
+			uint32_t v2 = v - cols_len, v3 = v - cols_len - 1, v4 = v - 1;
+			indices[model->indices_len++] = v;
+			indices[model->indices_len++] = v2;
+			indices[model->indices_len++] = v3;
+			indices[model->indices_len++] = v;
+			indices[model->indices_len++] = v3;
+			indices[model->indices_len++] = v4;
+		}
+	}
+
+	for(c = 1; c < cols_len; c++) {
+		emit_skirt(model, terrain, rows[0], cols[c - 1], rows[0], cols[c], tile->skirt, up);
+		emit_skirt(model, terrain, rows[rows_len - 1], cols[c - 1], rows[rows_len - 1], cols[c], tile->skirt, up);
+	}
+	for(r = 1; r < rows_len; r++) {
+		emit_skirt(model, terrain, rows[r - 1], cols[0], rows[r], cols[0], tile->skirt, up);
+		emit_skirt(model, terrain, rows[r - 1], cols[cols_len - 1], rows[r], cols[cols_len - 1], tile->skirt, up);
+	}
+}
+
+/* add the mesh of a coarse LOD tile to the model, as the next chunk */
+static void build_lod_tile(struct terrain_model * terrain, const struct lod_tile * tile) {
+
+	struct model * model = &terrain->model;
+	struct model_chunk * chunk = &model->chunks[model->chunks_len++];
+	int i, j;
+	Vec4 n;
+
+	chunk->index_offset = model->indices_len;
+	if (terrain->shared_vertices) {
+		build_shared_lod_tile(terrain, tile);
+		chunk->index_count = model->indices_len - chunk->index_offset;
+		model_compute_chunk_bounds(model, chunk);
+		return;
+	}
+	for(i = tile->i0 + tile->step; i - tile->step < tile->i1; i += tile->step) {
+		int ii = i < tile->i1 ? i : tile->i1;
+		int i_prev = i - tile->step;
+		for(j = tile->j0 + tile->step; j - tile->step < tile->j1; j += tile->step) {
+			int jj = j < tile->j1 ? j : tile->j1;
+			int j_prev = j - tile->step;
+			emit_quad(model, terrain, ii, jj, i_prev, j_prev, &n);
+			if (i_prev == tile->i0) emit_skirt(model, terrain, i_prev, j_prev, i_prev, jj, tile->skirt, n);
+			if (ii == tile->i1) emit_skirt(model, terrain, ii, j_prev, ii, jj, tile->skirt, n);
+			if (j_prev == tile->j0) emit_skirt(model, terrain, i_prev, j_prev, ii, j_prev, tile->skirt, n);
+			if (jj == tile->j1) emit_skirt(model, terrain, i_prev, jj, ii, jj, tile->skirt, n);
+		}
+	}
+	chunk->index_count = model->indices_len - chunk->index_offset;
+	model_compute_chunk_bounds(model, chunk);
+}
+
+/* Split the full resolution mesh into TERR_CHUNK_SIZE chunks (level 0)
+ * and build coarser levels on top of them, each with tiles covering 2x2 tiles
+ * of the previous level, up to a single root tile.
+ */
+static void build_lod(struct terrain_model * terrain) {
+
+	struct model * model = &terrain->model;
+	uint32_t width = terrain->width, depth = terrain->depth;
+	uint32_t * indices = model->indices;
+	uint32_t ind = 0;
+	int i, j, ci, cj;
+	int level;
+
+	/* number of tiles on each level */
+	uint32_t tiles_x[32], tiles_z[32];
+	int levels = 0;
+	uint32_t total_tiles = 0, coarse_tiles = 0;
+
+	tiles_x[0] = (width + TERR_CHUNK_SIZE - 2) / TERR_CHUNK_SIZE;
+	tiles_z[0] = (depth + TERR_CHUNK_SIZE - 2) / TERR_CHUNK_SIZE;
+	total_tiles = tiles_x[0] * tiles_z[0];
+	for(levels = 1; tiles_x[levels - 1] > 1 || tiles_z[levels - 1] > 1; levels++) {
+		tiles_x[levels] = (tiles_x[levels - 1] + 1) / 2;
+		tiles_z[levels] = (tiles_z[levels - 1] + 1) / 2;
+		coarse_tiles += tiles_x[levels] * tiles_z[levels];
+	}
+	total_tiles += coarse_tiles;
+
+	model->chunks = (struct model_chunk *)calloc(total_tiles, sizeof(struct model_chunk));
+	model->lod_nodes = (struct model_lod_node *)calloc(total_tiles, sizeof(struct model_lod_node));
+	model->lod_nodes_len = total_tiles;
+
+	/* level 0: indices are emitted tile by tile, so each chunk is a continuous range */
+	for(ci = 0; ci < tiles_z[0]; ci++) {
+		for(cj = 0; cj < tiles_x[0]; cj++) {
+			struct model_chunk * chunk = &model->chunks[model->chunks_len++];
+			chunk->index_offset = ind;
+			/* cell (i, j) is the quad with its far corner in grid point (i, j) */
+			for(i = 1 + ci * TERR_CHUNK_SIZE; i < depth && i <= (ci + 1) * TERR_CHUNK_SIZE; i++) {
+				for(j = 1 + cj * TERR_CHUNK_SIZE; j < width && j <= (cj + 1) * TERR_CHUNK_SIZE; j++) {
+					if (terrain->shared_vertices) {
+						/*    v4----v
+						 *    | 2 / |
+						 *    | / 1 |
+						 *    v3----v2   */
+						uint32_t v = i * width + j;
+						uint32_t v2 = v - width, v3 = v - width - 1, v4 = v - 1;
+						indices[ind++] = v;
+						indices[ind++] = v2;
+						indices[ind++] = v3;
+						indices[ind++] = v;
+						indices[ind++] = v3;
+						indices[ind++] = v4;
+						continue;
+					}
+					uint32_t v = (i * width + j) * 6;
+					indices[ind++] = v;
+					indices[ind++] = v + 1;
+					indices[ind++] = v + 2;
+					indices[ind++] = v + 3;
+					indices[ind++] = v + 4;
+					indices[ind++] = v + 5;
+				}
 			}
-			fp = NULL;
+			chunk->index_count = ind - chunk->index_offset;
+			model_compute_chunk_bounds(model, chunk);
 		}
-		uint32_t i;
-		for(i = 0; i < nbytes; i++) {
-			heightmap[b_read + i] = (float)buf[i] - sea_level;
+	}
+	model->indices_len = ind;
+
+	/* room for the coarse levels: per tile the quads and up to four skirted edges */
+	uint32_t tile_verts = TERR_CHUNK_SIZE * TERR_CHUNK_SIZE * 6 + 4 * TERR_CHUNK_SIZE * 4;
+	uint32_t tile_indices = TERR_CHUNK_SIZE * TERR_CHUNK_SIZE * 6 + 4 * TERR_CHUNK_SIZE * 12;
+	model->vertices = (struct vertex_data *)realloc(model->vertices,
+			(model->vertices_len + coarse_tiles * tile_verts) * sizeof(struct vertex_data));
+	model->indices = (uint32_t *)realloc(model->indices,
+			(model->indices_len + coarse_tiles * tile_indices) * sizeof(uint32_t));
+
+	uint32_t level_start = 0, prev_level_start = 0;
+	for(level = 0; level < levels; level++) {
+		int step = 1 << level;
+		int tile_cells = TERR_CHUNK_SIZE * step;
+		float tile_size = tile_cells * x_step;
+		for(ci = 0; ci < tiles_z[level]; ci++) {
+			for(cj = 0; cj < tiles_x[level]; cj++) {
+				uint32_t n = level_start + ci * tiles_x[level] + cj;
+				struct model_lod_node * node = &model->lod_nodes[n];
+				uint32_t k;
+
+				for(k = 0; k < 4; k++) node->children[k] = MODEL_LOD_NONE;
+				if (level == 0) {
+					node->chunk = n;
+					continue;
+				}
+
+				struct lod_tile tile = {
+					.i0 = ci * tile_cells,
+					.j0 = cj * tile_cells,
+					.step = step,
+				};
+				tile.i1 = (ci + 1) * tile_cells < depth ? (ci + 1) * tile_cells : depth - 1;
+				tile.j1 = (cj + 1) * tile_cells < width ? (cj + 1) * tile_cells : width - 1;
+
+				/* children: the previous level's tiles covering the same area */
+				float min_y = INFINITY, max_y = -INFINITY;
+				for(k = 0; k < 4; k++) {
+					uint32_t cz = ci * 2 + k / 2, cx = cj * 2 + k % 2;
+					if (cz >= tiles_z[level - 1] || cx >= tiles_x[level - 1]) continue;
+					node->children[k] = prev_level_start + cz * tiles_x[level - 1] + cx;
+					const struct model_chunk * child = &model->chunks[model->lod_nodes[node->children[k]].chunk];
+					if (child->bounds_min.y < min_y) min_y = child->bounds_min.y;
+					if (child->bounds_max.y > max_y) max_y = child->bounds_max.y;
+				}
+				/* the coarse surface never strays from the finer one by more than
+				 * the height range of the area */
+				tile.skirt = max_y - min_y + y_step;
+				node->split_distance = TERR_LOD_RANGE * tile_size;
+
+				node->chunk = model->chunks_len;
+				build_lod_tile(terrain, &tile);
+			}
 		}
-		b_read += nbytes;
+		prev_level_start = level_start;
+		level_start += tiles_x[level] * tiles_z[level];
 	}
+	model->lod_root = prev_level_start;
 
-	struct vertex_data * verts = (struct vertex_data *)calloc(vert_count * 6, sizeof(struct vertex_data));
+	/* release the unused part of the reservation */
+	model->vertices = (struct vertex_data *)realloc(model->vertices,
+			model->vertices_len * sizeof(struct vertex_data));
+	model->indices = (uint32_t *)realloc(model->indices,
+			model->indices_len * sizeof(uint32_t));
+}
+
+struct model * create_terrain(uint32_t width, uint32_t depth, const char * heightmap_path, float sea_level,
+				bool shared_vertices) {
+
+	struct terrain_model * terrain = (struct terrain_model *)calloc(1, sizeof(struct terrain_model));
+	terrain->model.type = TERRAIN_MODEL;
+	terrain->width = width;
+	terrain->depth = depth;
+	terrain->shared_vertices = shared_vertices;
+	terrain->heightmap = heightmap_open(heightmap_path, width, depth, sea_level);
+	int vert_count = width * depth;
+	int vert_copies = shared_vertices ? 1 : 6;
+
+	struct vertex_data * verts = (struct vertex_data *)calloc(vert_count * vert_copies, sizeof(struct vertex_data));
 	terrain->model.vertices = verts;
-	terrain->model.vertices_len = vert_count * 6;
+	terrain->model.vertices_len = vert_count * vert_copies;
 	terrain->model.triangles = (width - 1) * (depth - 1) * 2;
 	uint32_t * indices = (uint32_t *)malloc(terrain->model.triangles * 3 * sizeof(uint32_t));
 	terrain->model.indices = indices;
 
 	int i, j;
 
-	float z = - z_step * width / 2;
-
 	int v = 0;
-	uint32_t ind = 0;
 	for(i = 0; i < depth; i ++) {
-		float x = - x_step * width / 2;
 		for(j = 0; j < width; j++) {
-			float y = heightmap[(depth - i - 1) * width + j] * y_step;
-			Vec4 pos = { x, y, z, 1.0f };
 			Vec4 normal = { 0.0f, 1.0f, 0.0f, 0.0f };
-			verts[v].pos = pos;
-			if ( y / y_step < TERR_GRASS_THRESHOLD) verts[v].material = MATERIAL_SAND;
-			else if ( y / y_step < TERR_ROCK_THRESHOLD) verts[v].material = MATERIAL_GRASS;
-			else if ( y / y_step < TERR_SNOW_THRESHOLD) verts[v].material = MATERIAL_ROCK;
-			else verts[v].material = MATERIAL_SNOW;
+			verts[v] = grid_vertex(terrain, i, j);
 			verts[v].normal = normal;
-			verts[v].flags = V_FLAG_FLAT;
+			if (shared_vertices) {
+				v++;
+				continue;
+			}
 			uint32_t k;
 			for(k = 1; k < 6; k++) verts[v + k] = verts[v];
 			if (i > 0 && j > 0) {
@@ -104,20 +375,25 @@ struct model * create_terrain(uint32_t width, uint32_t depth, const char * heigh
 				verts[v + 4].normal = n2;
 				verts[v + 5].pos = verts[v4].pos;
 				verts[v + 5].normal = n2;
-
-				indices[ind++] = v;
-				indices[ind++] = v + 1;
-				indices[ind++] = v + 2;
-				indices[ind++] = v + 3;
-				indices[ind++] = v + 4;
-				indices[ind++] = v + 5;
 			}
 			v += 6;
-			x += x_step;
 		}
-		z += z_step;
 	}
-	terrain->model.indices_len = ind;
+
+	build_lod(terrain);
+
+	model_compute_bounds(&terrain->model);
+
+	printf("terrain: %u vertices (%.1f MiB), %u indices (%.1f MiB), %.2f vertices per triangle, %s\n",
+			terrain->model.vertices_len,
+			terrain->model.vertices_len * sizeof(struct packed_vertex) / 1048576.0,
+			terrain->model.indices_len,
+			terrain->model.indices_len * sizeof(uint32_t) / 1048576.0,
+			terrain->model.vertices_len * 3.0 / terrain->model.indices_len,
+			shared_vertices ? "shared vertices" : "duplicated vertices");
+
+	// the meshes are built, keep only what sample_terrain_height() touches
+	heightmap_release_tiles(terrain->heightmap);
 
 	return (struct model *)terrain;
 }
@@ -130,20 +406,20 @@ float sample_terrain_height(struct model * model, float x, float z) {
 	float sx = x / x_step + terrain->width / 2 + 0.5;
 	float sz = z / z_step + terrain->depth / 2 + 0.5;
 
-	if (sx < 0) sx = 0;
-	uint32_t nx = sx;
-	if (sx >= terrain->width) sx = terrain->width - 1;
-	if (sz < 0) sz = 0;
-	uint32_t nz = sz;
-	if (sz >= terrain->depth) sz = terrain->depth - 1;
-	sz = terrain->depth - sz - 1;
-	return terrain->heightmap[terrain->width * nz + nx];
+	// heightmap_get() clamps to the map
+	int32_t nx = floorf(sx);
+	int32_t nz = floorf(sz);
+	return heightmap_get(terrain->heightmap, nx, (int32_t)terrain->depth - nz - 1);
 }
 
 
 void terrain_finalize(struct model * model) {
 
 	assert(model->type == TERRAIN_MODEL);
+	struct terrain_model * terrain = (struct terrain_model *)model;
+
+	if (terrain->heightmap) heightmap_close(terrain->heightmap);
+	terrain->heightmap = NULL;
 }
 
 const struct model_type terrain_model_type = {
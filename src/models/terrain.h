@@ -2,8 +2,12 @@
 #define models_terrain_h
 
 #include "model.h"
+#include <stdbool.h>
 
-struct model * create_terrain(uint32_t width, uint32_t depth, const char * heightmap_path, float sea_level);
+/* with shared_vertices each grid point is stored once and faces are shaded
+ * with V_FLAG_FACETED, instead of six flat-shaded copies per grid point */
+struct model * create_terrain(uint32_t width, uint32_t depth, const char * heightmap_path, float sea_level,
+				bool shared_vertices);
 
 float sample_terrain_height(struct model * terrain, float x, float z);
 
@@ -20,4 +24,11 @@ extern const struct model_type terrain_model_type;
 #define TERR_Y_STEP 1.0f
 #define TERR_Z_STEP 2.0f
 
+/* terrain chunk (tile) size, in heightmap cells; coarser LOD levels use
+ * the same number of cells, each twice as large as on the previous level */
+#define TERR_CHUNK_SIZE 32
+
+/* a LOD node is split when the eye is closer than this many node sizes */
+#define TERR_LOD_RANGE 1.5f
+
 #endif
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pipeline_cache.h"
+
+#define CACHE_DIR "vulkanplay"
+#define CACHE_FILE "pipeline.cache"
+
+/* header written by the driver at the start of vkGetPipelineCacheData() */
+struct cache_header {
+	uint32_t header_size;
+	uint32_t header_version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint8_t uuid[VK_UUID_SIZE];
+};
+
+/* Build the cache file path in buf, creating the directories if create is set.
+ * $XDG_CACHE_HOME/vulkanplay/pipeline.cache or ~/.cache/vulkanplay/pipeline.cache
+ */
+static bool cache_path(char * buf, size_t size, bool create) {
+
+	const char * base = getenv("XDG_CACHE_HOME");
+	int len;
+
+	if (base && base[0]) {
+		len = snprintf(buf, size, "%s", base);
+	}
+	else {
+		const char * home = getenv("HOME");
+		if (!home || !home[0]) return false;
+		len = snprintf(buf, size, "%s/.cache", home);
+	}
+	if (len < 0 || (size_t)len >= size) return false;
+	if (create && mkdir(buf, 0700) < 0 && errno != EEXIST) return false;
+
+	len += snprintf(buf + len, size - len, "/" CACHE_DIR);
+	if ((size_t)len >= size) return false;
+	if (create && mkdir(buf, 0700) < 0 && errno != EEXIST) return false;
+
+	len += snprintf(buf + len, size - len, "/" CACHE_FILE);
+	if ((size_t)len >= size) return false;
+	return true;
+}
+
+/* check if the data was produced by the current driver and device */
+static bool cache_data_valid(const void * data, size_t size) {
+
+	struct cache_header header;
+
+	if (size < sizeof(header)) return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (header.header_size < sizeof(header) || header.header_size > size) return false;
+	if (header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return false;
+	if (header.vendor_id != vkapi.device_properties.vendorID) return false;
+	if (header.device_id != vkapi.device_properties.deviceID) return false;
+	if (memcmp(header.uuid, vkapi.device_properties.pipelineCacheUUID, VK_UUID_SIZE)) return false;
+	return true;
+}
+
+static void * read_cache_file(size_t * size) {
+
+	char path[4096];
+	void * data = NULL;
+	FILE * f = NULL;
+	long len;
+
+	if (!cache_path(path, sizeof(path), false)) return NULL;
+
+	f = fopen(path, "rb");
+	if (!f) return NULL;
+
+	if (fseek(f, 0, SEEK_END) < 0) goto error;
+	len = ftell(f);
+	if (len <= 0) goto error;
+	rewind(f);
+
+	data = malloc(len);
+	if (!data) goto error;
+	if (fread(data, 1, len, f) != (size_t)len) goto error;
+	fclose(f);
+
+	if (!cache_data_valid(data, len)) {
+		fprintf(stderr, "Pipeline cache %s does not match the device, ignoring it\n", path);
+		free(data);
+		return NULL;
+	}
+
+	*size = len;
+	return data;
+error:
+	fprintf(stderr, "Could not read pipeline cache %s\n", path);
+	if (data) free(data);
+	fclose(f);
+	return NULL;
+}
+
+VkPipelineCache pipeline_cache_load(bool * loaded) {
+
+	VkResult result;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	size_t size = 0;
+	void * data = read_cache_file(&size);
+
+	VkPipelineCacheCreateInfo pc_ci = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = data,
+	};
+
+	result = vkapi.vkCreatePipelineCache(vkapi.device, &pc_ci, NULL, &cache);
+	if (result != VK_SUCCESS && data) {
+		// the driver may still reject the data, start with an empty cache
+		pc_ci.initialDataSize = 0;
+		pc_ci.pInitialData = NULL;
+		free(data);
+		data = NULL;
+		result = vkapi.vkCreatePipelineCache(vkapi.device, &pc_ci, NULL, &cache);
+	}
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkCreatePipelineCache failed: %i\n", result);
+		cache = VK_NULL_HANDLE;
+	}
+
+	*loaded = (cache && data);
+	if (data) free(data);
+	return cache;
+}
+
+void pipeline_cache_save(VkPipelineCache cache) {
+
+	VkResult result;
+	char path[4096];
+	char tmp_path[4096 + 16] = "";
+	void * data = NULL;
+	size_t size = 0;
+	FILE * f = NULL;
+
+	if (!cache) return;
+	if (!cache_path(path, sizeof(path), true)) {
+		fprintf(stderr, "Could not create the pipeline cache directory\n");
+		return;
+	}
+
+	result = vkapi.vkGetPipelineCacheData(vkapi.device, cache, &size, NULL);
+	if (result != VK_SUCCESS || !size) return;
+	data = malloc(size);
+	if (!data) return;
+	result = vkapi.vkGetPipelineCacheData(vkapi.device, cache, &size, data);
+	if (result != VK_SUCCESS) goto error;
+
+	// write to a temporary file and rename it, so a concurrently starting
+	// instance never sees a partially written cache
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%li", path, (long)getpid());
+	f = fopen(tmp_path, "wb");
+	if (!f) goto error;
+	if (fwrite(data, 1, size, f) != size) goto error;
+	if (fclose(f)) {
+		f = NULL;
+		goto error;
+	}
+	f = NULL;
+	if (rename(tmp_path, path) < 0) goto error;
+
+	free(data);
+	return;
+error:
+	fprintf(stderr, "Could not write pipeline cache %s\n", path);
+	if (f) fclose(f);
+	if (tmp_path[0]) unlink(tmp_path);
+	free(data);
+}
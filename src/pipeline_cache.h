@@ -0,0 +1,17 @@
+#ifndef pipeline_cache_h
+#define pipeline_cache_h
+
+#include <stdbool.h>
+
+#include "vkapi.h"
+
+/* Create a pipeline cache, initialized with the data saved by a previous
+ * run on the same device, if available.
+ * 'loaded' is set to true when valid data was found on disk.
+ */
+VkPipelineCache pipeline_cache_load(bool * loaded);
+
+/* Save the pipeline cache contents to disk */
+void pipeline_cache_save(VkPipelineCache cache);
+
+#endif
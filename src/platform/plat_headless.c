@@ -0,0 +1,66 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "vkapi.h"
+#include "surface.h"
+#include "main.h"
+#include "platform/plat_headless.h"
+
+/* No window system at all – the renderer draws into offscreen images.
+ * Useful for benchmarks and CI on software Vulkan drivers (e.g. lavapipe).
+ */
+
+struct plat_surface* plat_headless_get_surface(void) {
+
+	struct plat_surface * surf = calloc(1, sizeof(struct plat_surface));
+
+	/* no VkSurfaceKHR – this is how the renderer knows it is headless */
+	surf->vk_surface = VK_NULL_HANDLE;
+
+	surf->event_loop = plat_headless_event_loop;
+	surf->destroy = plat_headless_destroy_surface;
+	surf->width = options.win_width;
+	surf->height = options.win_height;
+
+	printf("Using headless (offscreen) surface %ux%u\n", surf->width, surf->height);
+
+	return surf;
+}
+
+static volatile int _plat_headless_signal_received = 0;
+
+static void _plat_headless_sig_handler(int signum) {
+
+	_plat_headless_signal_received = signum;
+}
+
+void plat_headless_event_loop(struct plat_surface *surf) {
+
+	struct sigaction old_sa;
+	struct sigaction sa = {
+		.sa_handler = _plat_headless_sig_handler,
+	};
+	sigaction(SIGINT, &sa, &old_sa);
+
+	/* no events to process, just wait for the renderer (or a signal) */
+	while(!exit_requested() && !_plat_headless_signal_received) {
+		usleep(10000);
+	}
+
+	printf("Finishing platform event loop (exit_requested=%i, signal_received=%i).\n", exit_requested(), _plat_headless_signal_received);
+	if (_plat_headless_signal_received) {
+		printf("Signal %i received\n", _plat_headless_signal_received);
+	}
+	request_exit();
+
+	sigaction(SIGINT, &old_sa, NULL);
+}
+
+void plat_headless_destroy_surface(struct plat_surface *surf) {
+
+	finalize_surface(surf);
+
+	free(surf);
+}
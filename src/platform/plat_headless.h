@@ -0,0 +1,8 @@
+#ifndef plat_headless
+#include "main.h"
+
+struct plat_surface * plat_headless_get_surface(void);
+void plat_headless_destroy_surface(struct plat_surface *surf);
+void plat_headless_event_loop(struct plat_surface *surf);
+
+#endif
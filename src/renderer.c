@@ -7,7 +7,7 @@
 #include <alloca.h>
 #include <pthread.h>
 #include <assert.h>
-#include <sys/time.h>
+#include <stddef.h>
 
 #include "printmath.h"
 
@@ -17,6 +17,11 @@
 #include "main.h"
 
 #include "scene.h"
+#include "pipeline_cache.h"
+#include "arena.h"
+#include "workers.h"
+#include "timing.h"
+#include "frame_pacer.h"
 
 struct framebuffer {
 
@@ -28,23 +33,93 @@ struct framebuffer {
 	VkImageView depth_buf_view;
 
 	uint32_t width, height;
+};
+
+/* per frame-in-flight state */
+struct frame {
+	VkCommandBuffer command_buffer;
+	VkFence fence; /* signalled when the frame's commands complete */
+
+	VkSemaphore image_acquired_sem, rendering_complete_sem;
+
+	VkDescriptorSet descriptor_set;
+	bool descriptor_dirty; /* the buffer was replaced, update before use */
+	uint32_t uniform_offset; /* uniforms, materials and lights */
+	uint32_t instance_offset; /* struct instance_data array, by instance_index */
+	uint32_t instance_list_offset; /* instance_index of each instance drawn */
+	uint32_t draw_offset; /* VkDrawIndexedIndirectCommand array */
+	uint32_t draws_len;
+
+	/* --gpu-cull */
+	VkDescriptorSet cull_descriptor_set;
+	uint32_t cull_offset; /* struct cull_header, struct cull_candidate array */
+	uint32_t candidates_len;
+	VkBuffer stats_buffer; /* the counters of the last frame are in this buffer */
 
 	VkQueryPool query_pool;
+
+	/* statistics of the last frame rendered in this slot, for --stats */
+	bool stats_pending;
+	uint32_t objects_total, objects_culled;
+	uint32_t chunks_total, chunks_culled;
+	uint32_t instances_written;
+	uint32_t instances_drawn;
 };
 
-#define FRAME_LAG 2
+/* initial arena sizes, they grow by half when full */
+#define ARENA_INITIAL_VERTICES 65536
+#define ARENA_INITIAL_INDICES 262144
+#define ARENA_INITIAL_INSTANCES 256
+
+/* buffer replaced while the frames in flight may still be using it */
+struct retired_buffer {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	VkCommandBuffer cmd_buffer;
+	uint64_t frame; /* frame_number when retired */
+};
+
+/* draw recording thread state, with --threads */
+struct record_worker {
+	VkCommandPool command_pool; /* command pools are externally synchronized */
+	VkCommandBuffer cmd_buffers[FRAME_LAG_MAX]; /* secondary, per frame slot */
+};
+
+/* times each thread count is timed by --record-bench */
+#define RECORD_BENCH_RUNS 200
+
+/* the statistics collected for --stats */
+#define STATS_QUERY_FLAGS (VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT \
+				| VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT \
+				| VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT \
+				| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT \
+				| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT \
+				| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+/* number of images to render into when there is no swapchain, at least one
+ * per frame in flight: with no acquire semaphore, an image must not be
+ * reused before the fence of the frame rendering into it was waited on */
+#define OFFSCREEN_IMAGES 3
+#define OFFSCREEN_IMAGES_MAX (FRAME_LAG_MAX > OFFSCREEN_IMAGES ? FRAME_LAG_MAX : OFFSCREEN_IMAGES)
 
 struct renderer {
 	struct plat_surface * surface;
 	struct scene * scene;
 
+	/* no swapchain, render to offscreen images */
+	bool headless;
+	/* layout the images are left in after rendering */
+	VkImageLayout present_layout;
+
 	VkSwapchainKHR swapchain;
 	VkImage* swapchain_images;
 	uint32_t swapchain_image_count;
 
-	VkSemaphore image_acquired_sem, rendering_complete_sem;
-	VkFence frame_fences[FRAME_LAG];
-	int frame_fences_ready[FRAME_LAG];
+	VkDeviceMemory offscreen_memory;
+	uint32_t offscreen_next;
+
+	struct frame frames[FRAME_LAG_MAX];
+	uint32_t frame_lag;
 
 	VkExtent2D fb_extent;
 	uint32_t fb_count;
@@ -56,75 +131,946 @@ struct renderer {
 	VkDescriptorPool descriptor_pool;
 
 	VkPipeline pipeline;
+	VkPipelineCache pipeline_cache;
+	const char * pipeline_cache_state; /* for the startup time report */
 
+	/* materials and lights offsets within each frame's uniform region */
 	uint32_t materials_offset;
 	uint32_t lights_offset;
+	uint32_t uniform_size;
+	/* space in the mesh buffer and the instance regions */
+	struct arena * vertex_arena;
+	struct arena * index_arena;
+	struct arena * instance_arena;
 	uint32_t vertex_offset;
-	uint32_t vertex_count;
-	uint32_t instance_offset;
-	uint32_t instance_count;
 	uint32_t index_offset;
-	uint32_t index_count;
+	uint32_t draw_capacity; /* indirect draws per frame */
+
+	/* frame slots holding the current materials and lights, bit per slot */
+	uint32_t materials_valid;
+	/* frame slots holding the current culling candidates, bit per slot */
+	uint32_t candidates_valid;
+
+	/* frames rendered, to tell when the retired buffers and ranges are not in use */
+	uint64_t frame_number;
+	struct retired_buffer * retired;
+	uint32_t retired_len, retired_size;
+
+	VkDeviceMemory memory;
+	VkBuffer buffer; /* host-visible, per-frame data */
+
+	VkDeviceMemory mesh_memory;
+	VkBuffer mesh_buffer; /* vertices and indices */
+	bool meshes_device_local;
+
+	VkCommandPool command_pool;
+
+	VkShaderModule vs_module;
+	VkShaderModule fs_module;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSetLayout set_layout;
+
+	/* culling compute pass, with --gpu-cull */
+	bool gpu_cull;
+	VkShaderModule cs_module;
+	VkPipeline cull_pipeline;
+	VkPipelineLayout cull_pipeline_layout;
+	VkDescriptorSetLayout cull_set_layout;
+
+	/* secondary command buffer recording, with --threads */
+	struct worker_pool * workers;
+	struct record_worker * record_workers;
+	uint32_t record_workers_len;
+
+	unsigned char * mapped_memory;
+
+	Mat4 p_matrix;
+	Mat4 v_matrix;
+
+	/* the eye the frame is rendered with, interpolated from the scene's view */
+	Vec3 eye_pos, eye_dir;
+	bool view_dirty; /* changed since the instance data was written */
+
+	/* visible objects' model matrices and instance indices, for mat4_batch_instances() */
+	Mat4 * batch_models;
+	uint32_t * batch_index;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	bool stop; /* request to stop the rendering thread */
+};
+
+struct uniform_buffer {
+	Mat4 v_matrix;
+	Vec4 ambient_light;
+	// struct material materials[];
+	// struct light lights[];
+};
+
+struct instance_data {
+	Mat4 mv_matrix;
+	Mat4 mvp_matrix;
+	Mat4 normal_matrix;
+};
+
+/* culling compute shader input and output, see cull.comp */
+struct cull_header {
+	uint32_t draw_count;
+	uint32_t culled_count;
+	uint32_t pad[2];
+};
+
+struct cull_candidate {
+	Vec4 bounds_min; /* w: split distance, 0 when never split */
+	Vec4 bounds_max; /* w: parent's split distance, negative without a parent */
+	Vec4 parent_min;
+	Vec4 parent_max;
+	Vec4 pos_scale;
+	uint32_t draw[4]; /* index count, first index, vertex offset, instance */
+};
+
+struct cull_push_constants {
+	Vec4 planes[6];
+	uint32_t candidates_len;
+	uint32_t compact;
+};
+
+#define CULL_GROUP_SIZE 64
+
+extern const unsigned char cull_comp_spv[];
+extern unsigned int cull_comp_spv_len;
+extern const unsigned char main_frag_spv[];
+extern unsigned int main_frag_spv_len;
+extern const unsigned char main_vert_spv[];
+extern unsigned int main_vert_spv_len;
+
+/* Create a buffer bound to its own memory allocation of the requested type.
+ * Returns VK_ERROR_FEATURE_NOT_PRESENT, without a message, when there is no
+ * such memory type, so the caller can fall back to another one.
+ */
+static VkResult create_buffer_memory(VkDeviceSize size, VkBufferUsageFlags usage,
+				VkMemoryPropertyFlags properties,
+				VkBuffer * buffer, VkDeviceMemory * memory) {
+
+	VkResult result;
+
+	*buffer = VK_NULL_HANDLE;
+	*memory = VK_NULL_HANDLE;
+
+	VkBufferCreateInfo buffer_ci = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+	};
+	result = vkapi.vkCreateBuffer(vkapi.device, &buffer_ci, NULL, buffer);
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkCreateBuffer failed: %i\n", result);
+		goto error;
+	}
+
+	VkMemoryRequirements mem_req;
+	vkapi.vkGetBufferMemoryRequirements(vkapi.device, *buffer, &mem_req);
+
+	VkMemoryAllocateInfo mem_ai = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = mem_req.size,
+		.memoryTypeIndex = vkapi_find_memory_type(mem_req.memoryTypeBits, properties),
+	};
+	if (mem_ai.memoryTypeIndex == UINT32_MAX) {
+		result = VK_ERROR_FEATURE_NOT_PRESENT;
+		goto error;
+	}
+	result = vkapi.vkAllocateMemory(vkapi.device, &mem_ai, NULL, memory);
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkAllocateMemory failed: %i\n", result);
+		goto error;
+	}
+	vkapi.vkBindBufferMemory(vkapi.device, *buffer, *memory, 0);
+	return VK_SUCCESS;
+error:
+	if (*buffer) vkapi.vkDestroyBuffer(vkapi.device, *buffer, NULL);
+	*buffer = VK_NULL_HANDLE;
+	return result;
+}
+
+/* all draws are indexed, the models without indices get a trivial index list */
+static inline uint32_t mesh_indices_len(const struct model * model) {
+
+	return model->indices ? model->indices_len : model->vertices_len;
+}
+
+/* Pack a mesh's vertices and copy its indices */
+static void write_mesh(struct scene_mesh * mesh, unsigned char * vertices, unsigned char * indices) {
+
+	struct model * model = mesh->model;
+	uint32_t i;
+
+	model_pack_vertices(model, (struct packed_vertex *)vertices, &mesh->r.pos_offset, &mesh->r.pos_scale);
+	if (model->indices) {
+		memcpy(indices, model->indices, model->indices_len * sizeof(uint32_t));
+	}
+	else {
+		for(i = 0; i < model->vertices_len; i++) {
+			((uint32_t *)indices)[i] = i;
+		}
+	}
+}
+
+/* Keep a buffer, and the command buffer which used it, until the frames
+ * submitted so far have completed */
+static void retire_buffer(struct renderer * renderer, VkBuffer buffer, VkDeviceMemory memory,
+				VkCommandBuffer cmd_buffer) {
+
+	if (renderer->retired_len == renderer->retired_size) {
+		uint32_t new_size = renderer->retired_size ? renderer->retired_size * 2 : 8;
+		struct retired_buffer * retired = realloc(renderer->retired, new_size * sizeof(struct retired_buffer));
+		if (!retired) {
+			/* better a stall than a leak */
+			vkapi.vkDeviceWaitIdle(vkapi.device);
+			if (cmd_buffer) vkapi.vkFreeCommandBuffers(vkapi.device, renderer->command_pool, 1, &cmd_buffer);
+			if (buffer) vkapi.vkDestroyBuffer(vkapi.device, buffer, NULL);
+			if (memory) vkapi.vkFreeMemory(vkapi.device, memory, NULL);
+			return;
+		}
+		renderer->retired = retired;
+		renderer->retired_size = new_size;
+	}
+	renderer->retired[renderer->retired_len++] = (struct retired_buffer){
+		.buffer = buffer,
+		.memory = memory,
+		.cmd_buffer = cmd_buffer,
+		.frame = renderer->frame_number,
+	};
+}
+
+/* Release the buffers retired at or before 'frame' */
+static void release_retired(struct renderer * renderer, uint64_t frame) {
+
+	uint32_t i;
+
+	for(i = 0; i < renderer->retired_len && renderer->retired[i].frame <= frame; i++) {
+		struct retired_buffer * r = &renderer->retired[i];
+		if (r->cmd_buffer) vkapi.vkFreeCommandBuffers(vkapi.device, renderer->command_pool, 1, &r->cmd_buffer);
+		if (r->buffer) vkapi.vkDestroyBuffer(vkapi.device, r->buffer, NULL);
+		if (r->memory) vkapi.vkFreeMemory(vkapi.device, r->memory, NULL);
+	}
+	if (!i) return;
+	memmove(renderer->retired, renderer->retired + i, (renderer->retired_len - i) * sizeof(struct retired_buffer));
+	renderer->retired_len -= i;
+}
+
+/* Allocate from an arena, growing it by at least half when full */
+static uint32_t arena_alloc_grow(struct arena * arena, uint32_t len) {
+
+	uint32_t offset = arena_alloc(arena, len);
+	if (offset != ARENA_NONE) return offset;
+
+	uint32_t capacity = arena_capacity(arena);
+	uint32_t new_capacity = capacity + capacity / 2;
+	if (new_capacity < capacity + len) new_capacity = capacity + len;
+	arena_grow(arena, new_capacity);
+	return arena_alloc(arena, len);
+}
+
+/* Give the new and changed meshes their ranges in the vertex/index buffer
+ * and upload them, once for all the objects sharing a model.
+ *
+ * A changed mesh always gets a new range, so nothing the frames in flight
+ * may be drawing is overwritten; the old range is retired until they
+ * complete. When the ranges do not fit, the buffer grows by half and the old
+ * contents are copied over, on the GPU or, with --host-meshes, by the CPU.
+ * Nothing waits for the GPU, the old buffer, the staging buffer and the
+ * command buffer are retired.
+ * The dirty flags are left for sync_scene() to clear.
+ * Must be called with the scene locked, after the command pool is created.
+ */
+static bool update_meshes(struct renderer * renderer) {
+
+	VkResult result;
+	struct scene * scene = renderer->scene;
+	VkBuffer old_buffer = renderer->mesh_buffer;
+	VkDeviceMemory old_memory = renderer->mesh_memory;
+	VkBuffer staging_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory staging_memory = VK_NULL_HANDLE;
+	VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+	VkBufferCopy * regions = NULL;
+	uint32_t regions_len = 0;
+	unsigned char * mapped;
+	bool ok = false;
+	uint32_t i;
+
+	uint32_t old_vertex_capacity = arena_capacity(renderer->vertex_arena);
+	uint32_t old_index_capacity = arena_capacity(renderer->index_arena);
+	VkDeviceSize old_index_offset = renderer->index_offset;
+	VkDeviceSize upload_size = 0;
+	uint32_t upload_count = 0;
+
+	for(i = 0; i < scene->meshes_len; i++) {
+		struct scene_mesh * mesh = &scene->meshes[i];
+		struct model * model = mesh->model;
+
+		if (!model || !mesh->s.dirty) continue;
+
+		arena_free(renderer->vertex_arena, mesh->r.vertex_index, mesh->r.vertices_len, renderer->frame_number);
+		arena_free(renderer->index_arena, mesh->r.index_index, mesh->r.indices_len, renderer->frame_number);
+		mesh->r.vertex_index = arena_alloc_grow(renderer->vertex_arena, model->vertices_len);
+		mesh->r.index_index = arena_alloc_grow(renderer->index_arena, mesh_indices_len(model));
+		mesh->r.vertices_len = model->vertices_len;
+		mesh->r.indices_len = mesh_indices_len(model);
+		if (mesh->r.vertex_index == ARENA_NONE || mesh->r.index_index == ARENA_NONE) {
+			fprintf(stderr, "could not allocate the mesh buffer space\n");
+			return false;
+		}
+
+		upload_size += model->vertices_len * sizeof(struct packed_vertex)
+				+ mesh_indices_len(model) * sizeof(uint32_t);
+		upload_count++;
+	}
+	if (upload_count) renderer->candidates_valid = 0;
+
+	uint32_t vertex_capacity = arena_capacity(renderer->vertex_arena);
+	uint32_t index_capacity = arena_capacity(renderer->index_arena);
+	bool grow = !old_buffer || vertex_capacity != old_vertex_capacity || index_capacity != old_index_capacity;
+	if (!grow && !upload_count) return true;
+
+	if (grow) {
+		/* mesh buffer layout: vertices, indices */
+		VkDeviceSize size = sizeof(struct packed_vertex) * vertex_capacity
+					+ sizeof(uint32_t) * index_capacity;
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+					| VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		if (!old_buffer) renderer->meshes_device_local = !options.host_meshes;
+		result = VK_ERROR_FEATURE_NOT_PRESENT;
+		if (renderer->meshes_device_local) {
+			result = create_buffer_memory(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+							&renderer->mesh_buffer, &renderer->mesh_memory);
+			if (result == VK_ERROR_FEATURE_NOT_PRESENT && !old_buffer) {
+				fprintf(stderr, "VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT memory not found, using host memory for meshes\n");
+				renderer->meshes_device_local = false;
+			}
+		}
+		if (!renderer->meshes_device_local) {
+			result = create_buffer_memory(size, usage,
+							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							&renderer->mesh_buffer, &renderer->mesh_memory);
+			if (result == VK_ERROR_FEATURE_NOT_PRESENT) {
+				fprintf(stderr, "VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT memory not found!\n");
+			}
+		}
+		if (result != VK_SUCCESS) {
+			renderer->mesh_buffer = old_buffer;
+			renderer->mesh_memory = old_memory;
+			return false;
+		}
+		renderer->vertex_offset = 0;
+		renderer->index_offset = sizeof(struct packed_vertex) * vertex_capacity;
+		if (old_buffer) {
+			printf("mesh buffer grown to %u vertices, %u indices\n", vertex_capacity, index_capacity);
+		}
+	}
+
+	if (!renderer->meshes_device_local) {
+		vkapi.vkMapMemory(vkapi.device, renderer->mesh_memory, 0, VK_WHOLE_SIZE, 0, (void *)&mapped);
+		if (grow && old_buffer) {
+			/* the GPU only reads the old buffer, it is safe to copy from it */
+			unsigned char * old_mapped;
+			vkapi.vkMapMemory(vkapi.device, old_memory, 0, VK_WHOLE_SIZE, 0, (void *)&old_mapped);
+			memcpy(mapped + renderer->vertex_offset, old_mapped,
+					old_vertex_capacity * sizeof(struct packed_vertex));
+			memcpy(mapped + renderer->index_offset, old_mapped + old_index_offset,
+					old_index_capacity * sizeof(uint32_t));
+			vkapi.vkUnmapMemory(vkapi.device, old_memory);
+		}
+		for(i = 0; i < scene->meshes_len; i++) {
+			struct scene_mesh * mesh = &scene->meshes[i];
+			if (!mesh->model || !mesh->s.dirty) continue;
+			write_mesh(mesh,
+				mapped + renderer->vertex_offset + mesh->r.vertex_index * sizeof(struct packed_vertex),
+				mapped + renderer->index_offset + mesh->r.index_index * sizeof(uint32_t));
+		}
+		vkapi.vkUnmapMemory(vkapi.device, renderer->mesh_memory);
+		ok = true;
+		goto error;
+	}
+
+	if (upload_size) {
+		result = create_buffer_memory(upload_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						&staging_buffer, &staging_memory);
+		if (result == VK_ERROR_FEATURE_NOT_PRESENT) {
+			fprintf(stderr, "VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT memory not found!\n");
+		}
+		if (result != VK_SUCCESS) goto error;
+
+		regions = malloc(2 * upload_count * sizeof(VkBufferCopy));
+		if (!regions) goto error;
+
+		VkDeviceSize offset = 0;
+		vkapi.vkMapMemory(vkapi.device, staging_memory, 0, upload_size, 0, (void *)&mapped);
+		for(i = 0; i < scene->meshes_len; i++) {
+			struct scene_mesh * mesh = &scene->meshes[i];
+			if (!mesh->model || !mesh->s.dirty) continue;
+
+			VkDeviceSize vertices_size = mesh->r.vertices_len * sizeof(struct packed_vertex);
+			VkDeviceSize indices_size = mesh->r.indices_len * sizeof(uint32_t);
+			write_mesh(mesh, mapped + offset, mapped + offset + vertices_size);
+			if (vertices_size) {
+				regions[regions_len++] = (VkBufferCopy){
+					.srcOffset = offset,
+					.dstOffset = renderer->vertex_offset + mesh->r.vertex_index * sizeof(struct packed_vertex),
+					.size = vertices_size,
+				};
+			}
+			if (indices_size) {
+				regions[regions_len++] = (VkBufferCopy){
+					.srcOffset = offset + vertices_size,
+					.dstOffset = renderer->index_offset + mesh->r.index_index * sizeof(uint32_t),
+					.size = indices_size,
+				};
+			}
+			offset += vertices_size + indices_size;
+		}
+		vkapi.vkUnmapMemory(vkapi.device, staging_memory);
+	}
+
+	VkCommandBufferAllocateInfo cmd_buf_ai = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = renderer->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	result = vkapi.vkAllocateCommandBuffers(vkapi.device, &cmd_buf_ai, &cmd_buffer);
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkAllocateCommandBuffers failed: %i\n", result);
+		goto error;
+	}
+
+	VkCommandBufferBeginInfo cmd_buf_bi = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	vkapi.vkBeginCommandBuffer(cmd_buffer, &cmd_buf_bi);
+
+	if (old_buffer) {
+		/* the earlier uploads, to the old buffer or to the ranges reused now,
+		 * must be complete before the copies */
+		VkMemoryBarrier memory_b = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		};
+		vkapi.vkCmdPipelineBarrier(cmd_buffer,
+						VK_PIPELINE_STAGE_TRANSFER_BIT,
+						VK_PIPELINE_STAGE_TRANSFER_BIT,
+						0,
+						1, &memory_b, 0, NULL,
+						0, NULL);
+	}
+
+	if (grow && old_buffer) {
+		VkBufferCopy old_regions[2] = {
+			{
+				.srcOffset = 0,
+				.dstOffset = renderer->vertex_offset,
+				.size = old_vertex_capacity * sizeof(struct packed_vertex),
+			},
+			{
+				.srcOffset = old_index_offset,
+				.dstOffset = renderer->index_offset,
+				.size = old_index_capacity * sizeof(uint32_t),
+			},
+		};
+		vkapi.vkCmdCopyBuffer(cmd_buffer, old_buffer, renderer->mesh_buffer, 2, old_regions);
+	}
+
+	if (regions_len) {
+		vkapi.vkCmdCopyBuffer(cmd_buffer, staging_buffer, renderer->mesh_buffer, regions_len, regions);
+	}
+
+	VkBufferMemoryBarrier buffer_b = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = renderer->mesh_buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	vkapi.vkCmdPipelineBarrier(cmd_buffer,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+					0,
+					0, NULL, 1, &buffer_b,
+					0, NULL);
+
+	vkapi.vkEndCommandBuffer(cmd_buffer);
+
+	/* no fence, the frames submitted after it wait on the barrier
+	 * and their fences tell when the upload is complete */
+	const VkSubmitInfo submit = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	result = vkapi.vkQueueSubmit(vkapi.g_queue, 1, &submit, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkQueueSubmit failed: %i\n", result);
+		goto error;
+	}
+
+	ok = true;
+
+error:
+	/* also released on error, the command buffer may have been submitted */
+	if (cmd_buffer || staging_buffer) retire_buffer(renderer, staging_buffer, staging_memory, cmd_buffer);
+	free(regions);
+	if (renderer->mesh_buffer != old_buffer && old_buffer) {
+		retire_buffer(renderer, old_buffer, old_memory, VK_NULL_HANDLE);
+	}
+	return ok;
+}
+
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+
+	return (value + align - 1) / align * align;
+}
+
+/* Give the new objects their instance slots, growing the host-visible buffer
+ * when they, or 'draws' indirect draws per frame, do not fit.
+ *
+ * A new buffer holds no valid materials or instance data, they are rewritten,
+ * and the descriptor sets updated, as each frame slot comes up.
+ * Must be called with the scene locked.
+ */
+static bool update_instances(struct renderer * renderer, uint32_t draws) {
+
+	VkResult result;
+	struct scene * scene = renderer->scene;
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	uint32_t i;
+
+	uint32_t old_capacity = arena_capacity(renderer->instance_arena);
+	for(i = 0; i < scene->objects_len && scene->s.objects_dirty; i++) {
+		struct scene_object * obj = &scene->objects[i];
+		if (!obj->model || obj->r.has_instance) continue;
+		obj->r.instance_index = arena_alloc_grow(renderer->instance_arena, 1);
+		if (obj->r.instance_index == ARENA_NONE) {
+			fprintf(stderr, "could not allocate an instance\n");
+			return false;
+		}
+		obj->r.has_instance = 1;
+		obj->r.frames_valid = 0;
+	}
+	uint32_t capacity = arena_capacity(renderer->instance_arena);
+	if (renderer->buffer && capacity == old_capacity && draws <= renderer->draw_capacity) return true;
+
+	uint32_t draw_capacity = renderer->draw_capacity + renderer->draw_capacity / 2;
+	if (draw_capacity < draws) draw_capacity = draws;
+	if (!draw_capacity) draw_capacity = 1;
+
+	/* host-visible buffer layout:
+	 *   uniform region of each frame (uniform_buffer, materials, lights)
+	 *   instance region of each frame
+	 *   instance list region of each frame
+	 *   indirect draw region of each frame
+	 *   culling region of each frame (cull_header, candidates), with --gpu-cull
+	 * the regions are bound as storage buffers too, when culling on the GPU
+	 */
+	renderer->materials_offset = sizeof(struct uniform_buffer);
+	renderer->lights_offset = renderer->materials_offset + sizeof(struct material) * MATERIALS_MAX;
+	renderer->uniform_size = renderer->lights_offset + sizeof(struct light) * LIGHTS_MAX;
+	uint32_t align = vkapi.device_properties.limits.minUniformBufferOffsetAlignment;
+	if (align < vkapi.device_properties.limits.minStorageBufferOffsetAlignment) {
+		align = vkapi.device_properties.limits.minStorageBufferOffsetAlignment;
+	}
+	if (align < 16) align = 16;
+	uint32_t uniform_stride = align_up(renderer->uniform_size, align);
+	uint32_t instance_stride = align_up(sizeof(struct instance_data) * capacity, align);
+	uint32_t list_stride = align_up(sizeof(uint32_t) * capacity, align);
+	uint32_t draw_stride = align_up(sizeof(VkDrawIndexedIndirectCommand) * draw_capacity, align);
+	uint32_t cull_stride = 0;
+	if (renderer->gpu_cull) {
+		cull_stride = align_up(sizeof(struct cull_header) + sizeof(struct cull_candidate) * draw_capacity, align);
+	}
+	uint32_t mem_size = (uniform_stride + instance_stride + list_stride + draw_stride + cull_stride)
+				* renderer->frame_lag;
+
+	Mat4 * batch_models = realloc(renderer->batch_models, capacity * sizeof(Mat4));
+	if (!batch_models) return false;
+	renderer->batch_models = batch_models;
+	uint32_t * batch_index = realloc(renderer->batch_index, capacity * sizeof(uint32_t));
+	if (!batch_index) return false;
+	renderer->batch_index = batch_index;
+
+	result = create_buffer_memory(mem_size,
+					VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+						| VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&buffer, &memory);
+	if (result == VK_ERROR_FEATURE_NOT_PRESENT) {
+		fprintf(stderr, "VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT memory not found!\n");
+	}
+	if (result != VK_SUCCESS) return false;
+
+	if (renderer->buffer) {
+		vkapi.vkUnmapMemory(vkapi.device, renderer->memory);
+		retire_buffer(renderer, renderer->buffer, renderer->memory, VK_NULL_HANDLE);
+		printf("instance buffer grown to %u instances, %u draws\n", capacity, draw_capacity);
+	}
+	renderer->buffer = buffer;
+	renderer->memory = memory;
+	renderer->draw_capacity = draw_capacity;
+	vkapi.vkMapMemory(vkapi.device, renderer->memory, 0, mem_size, 0, (void *)&renderer->mapped_memory);
+
+	for(i = 0; i < renderer->frame_lag; i++) {
+		renderer->frames[i].uniform_offset = uniform_stride * i;
+		renderer->frames[i].instance_offset = uniform_stride * renderer->frame_lag + instance_stride * i;
+		renderer->frames[i].instance_list_offset = (uniform_stride + instance_stride) * renderer->frame_lag
+							+ list_stride * i;
+		renderer->frames[i].draw_offset = (uniform_stride + instance_stride + list_stride) * renderer->frame_lag
+							+ draw_stride * i;
+		renderer->frames[i].cull_offset = (uniform_stride + instance_stride + list_stride + draw_stride)
+							* renderer->frame_lag + cull_stride * i;
+		renderer->frames[i].descriptor_dirty = true;
+
+		if (renderer->gpu_cull) {
+			/* the culling pass draws by instance_index */
+			uint32_t * list = (uint32_t *)(renderer->mapped_memory + renderer->frames[i].instance_list_offset);
+			uint32_t j;
+			for(j = 0; j < capacity; j++) list[j] = j;
+		}
+	}
+
+	renderer->materials_valid = 0;
+	renderer->candidates_valid = 0;
+	for(i = 0; i < scene->objects_len; i++) {
+		scene->objects[i].r.frames_valid = 0;
+	}
+	return true;
+}
+
+/* Point the frame's descriptor sets at its regions in the current buffer.
+ * The set must not be in use, so this is done when the slot comes up.
+ */
+static void update_frame_descriptors(struct renderer * renderer, struct frame * frame) {
+
+	VkDescriptorBufferInfo d_buffer_infos[] = {
+		{
+			.buffer = renderer->buffer,
+			.offset = frame->uniform_offset,
+			.range = renderer->uniform_size,
+		},
+		{
+			.buffer = renderer->buffer,
+			.offset = frame->instance_offset,
+			.range = sizeof(struct instance_data) * arena_capacity(renderer->instance_arena),
+		},
+	};
+
+	/* candidates and counters, instances, draws */
+	VkDescriptorBufferInfo cull_buffer_infos[] = {
+		{
+			.buffer = renderer->buffer,
+			.offset = frame->cull_offset,
+			.range = sizeof(struct cull_header) + sizeof(struct cull_candidate) * renderer->draw_capacity,
+		},
+		{
+			.buffer = renderer->buffer,
+			.offset = frame->instance_offset,
+			.range = sizeof(struct instance_data) * arena_capacity(renderer->instance_arena),
+		},
+		{
+			.buffer = renderer->buffer,
+			.offset = frame->draw_offset,
+			.range = sizeof(VkDrawIndexedIndirectCommand) * renderer->draw_capacity,
+		},
+	};
+
+	VkWriteDescriptorSet w_descr_sets[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = frame->descriptor_set,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.pBufferInfo = &d_buffer_infos[0],
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = frame->descriptor_set,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.dstBinding = 1,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.pBufferInfo = &d_buffer_infos[1],
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = frame->cull_descriptor_set,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 3,
+			.pBufferInfo = cull_buffer_infos,
+		}
+	};
+
+	vkapi.vkUpdateDescriptorSets(vkapi.device, renderer->gpu_cull ? 3 : 2, w_descr_sets, 0, NULL);
+	frame->descriptor_dirty = false;
+}
+
+/* Apply the scene changes flagged since the last frame: release what the
+ * removed objects used, lay out and upload the new and changed meshes, and
+ * invalidate the instance data and materials which have to be rewritten.
+ * Must be called with the scene locked.
+ */
+static bool sync_scene(struct renderer * renderer) {
+
+	struct scene * scene = renderer->scene;
+	uint32_t i;
+
+	/* whatever was retired before the last completed frame is not in use any more */
+	if (renderer->frame_number >= renderer->frame_lag) {
+		uint64_t completed = renderer->frame_number - renderer->frame_lag;
+		arena_collect(renderer->vertex_arena, completed);
+		arena_collect(renderer->index_arena, completed);
+		arena_collect(renderer->instance_arena, completed);
+		release_retired(renderer, completed);
+	}
+
+	if (scene->s.objects_dirty) {
+		renderer->candidates_valid = 0;
+		for(i = 0; i < scene->objects_len; i++) {
+			struct scene_object * obj = &scene->objects[i];
+			if (obj->model) continue;
+			if (obj->r.has_instance) {
+				arena_free(renderer->instance_arena, obj->r.instance_index, 1, renderer->frame_number);
+			}
+			memset(&obj->r, 0, sizeof(obj->r));
+		}
+		for(i = 0; i < scene->meshes_len; i++) {
+			struct scene_mesh * mesh = &scene->meshes[i];
+			if (mesh->model) continue;
+			arena_free(renderer->vertex_arena, mesh->r.vertex_index, mesh->r.vertices_len, renderer->frame_number);
+			arena_free(renderer->index_arena, mesh->r.index_index, mesh->r.indices_len, renderer->frame_number);
+			memset(&mesh->r, 0, sizeof(mesh->r));
+		}
+	}
+	if (!update_meshes(renderer)) return false;
+
+	/* a view change moves every instance, otherwise only the ones whose matrix
+	 * changed, or whose mesh was packed again, with another position dequantization */
+	uint32_t draws = 0;
+	for(i = 0; i < scene->objects_len; i++) {
+		struct scene_object * obj = &scene->objects[i];
+		if (!obj->model) continue;
+		if (renderer->view_dirty || obj->s.matrix_dirty || scene->meshes[obj->mesh].s.dirty) {
+			obj->r.frames_valid = 0;
+			obj->s.matrix_dirty = 0;
+		}
+		/* at most one draw per LOD node or chunk */
+		if (obj->model->lod_nodes_len) draws += obj->model->lod_nodes_len;
+		else if (obj->model->chunks_len) draws += obj->model->chunks_len;
+		else draws += 1;
+	}
+	renderer->view_dirty = false;
+	for(i = 0; i < scene->meshes_len; i++) {
+		scene->meshes[i].s.dirty = 0;
+	}
+
+	if (!update_instances(renderer, draws)) return false;
+	scene->s.objects_dirty = 0;
+
+	if (scene->s.materials_dirty) {
+		renderer->materials_valid = 0;
+		scene->s.materials_dirty = 0;
+	}
+	return true;
+}
+
+/* Create the culling compute pipeline, for --gpu-cull */
+static void create_cull_pipeline(struct renderer * renderer) {
+
+	VkDescriptorSetLayoutBinding dsl_b[3] = {
+		{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		},
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		},
+		{
+			.binding = 2,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		},
+	};
+
+	VkDescriptorSetLayoutCreateInfo dsl_ci = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 3,
+		.pBindings = dsl_b,
+	};
+
+	vkapi.vkCreateDescriptorSetLayout(vkapi.device, &dsl_ci, NULL, &renderer->cull_set_layout);
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct cull_push_constants),
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_ci = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &renderer->cull_set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	vkapi.vkCreatePipelineLayout(vkapi.device, &pipeline_layout_ci, NULL, &renderer->cull_pipeline_layout);
+
+	VkShaderModuleCreateInfo cs_module_ci = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = cull_comp_spv_len,
+		.pCode = (uint32_t *)cull_comp_spv,
+	};
+
+	vkapi.vkCreateShaderModule(vkapi.device, &cs_module_ci, NULL, &renderer->cs_module);
+
+	VkComputePipelineCreateInfo pipeline_ci = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = renderer->cs_module,
+			.pName = "main",
+		},
+		.layout = renderer->cull_pipeline_layout,
+	};
+
+	vkapi.vkCreateComputePipelines(vkapi.device, renderer->pipeline_cache, 1, &pipeline_ci, NULL, &renderer->cull_pipeline);
+}
+
+static void destroy_record_workers(struct renderer * renderer) {
+
+	uint32_t i;
+
+	if (renderer->workers) worker_pool_destroy(renderer->workers);
+	renderer->workers = NULL;
+	for(i = 0; i < renderer->record_workers_len; i++) {
+		/* destroying the pool frees its command buffers */
+		struct record_worker * worker = &renderer->record_workers[i];
+		if (worker->command_pool) vkapi.vkDestroyCommandPool(vkapi.device, worker->command_pool, NULL);
+	}
+	free(renderer->record_workers);
+	renderer->record_workers = NULL;
+	renderer->record_workers_len = 0;
+}
+
+/* Start the --threads draw recording threads, each with its own command pool
+ * and a secondary command buffer for each frame slot.
+ * On failure the draws are recorded on the render thread.
+ */
+static void create_record_workers(struct renderer * renderer) {
+
+	uint32_t i;
+
+	if (!options.threads) return;
+	if (renderer->gpu_cull) {
+		fprintf(stderr, "--threads ignored with --gpu-cull, the draws are recorded on the render thread\n");
+		return;
+	}
 
-	VkDeviceMemory memory;
-	VkBuffer buffer;
-	VkDescriptorSet descriptor_set;
+	if (options.stats && !vkapi.device_features.inheritedQueries) {
+		/* the query could not stay active while the secondary buffers execute */
+		fprintf(stderr, "inheritedQueries not supported, no pipeline statistics with --threads\n");
+		for(i = 0; i < renderer->frame_lag; i++) {
+			struct frame * frame = &renderer->frames[i];
+			if (frame->query_pool) vkapi.vkDestroyQueryPool(vkapi.device, frame->query_pool, NULL);
+			frame->query_pool = VK_NULL_HANDLE;
+		}
+	}
 
-	VkFence cmd_buf_fence;
-	int cmd_buf_fence_ready;
-	VkCommandPool command_pool;
-	VkCommandBuffer command_buffer;
+	renderer->record_workers = calloc(options.threads, sizeof(struct record_worker));
+	if (!renderer->record_workers) goto error;
+	renderer->record_workers_len = options.threads;
 
-	VkShaderModule vs_module;
-	VkShaderModule fs_module;
-	VkPipelineLayout pipeline_layout;
-	VkDescriptorSetLayout set_layout;
+	for(i = 0; i < renderer->record_workers_len; i++) {
+		struct record_worker * worker = &renderer->record_workers[i];
 
-	unsigned char * mapped_memory;
+		VkCommandPoolCreateInfo cmd_pool_ci = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+			.queueFamilyIndex = vkapi.g_queue_family,
+		};
 
-	Mat4 p_matrix;
-	Mat4 v_matrix;
+		VkResult result = vkapi.vkCreateCommandPool(vkapi.device, &cmd_pool_ci, NULL, &worker->command_pool);
+		if (result != VK_SUCCESS) goto error;
 
-	pthread_t thread;
-	pthread_mutex_t mutex;
-	bool stop; /* request to stop the rendering thread */
-};
+		VkCommandBufferAllocateInfo cmd_buf_ai = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = worker->command_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+			.commandBufferCount = renderer->frame_lag,
+		};
 
-struct uniform_buffer {
-	Mat4 v_matrix;
-	Vec4 ambient_light;
-	// struct material materials[];
-	// struct light lights[];
-};
+		result = vkapi.vkAllocateCommandBuffers(vkapi.device, &cmd_buf_ai, worker->cmd_buffers);
+		if (result != VK_SUCCESS) goto error;
+	}
 
-struct instance_data {
-	Mat4 mv_matrix;
-	Mat4 mvp_matrix;
-	Mat4 normal_matrix;
-};
+	renderer->workers = worker_pool_create(renderer->record_workers_len);
+	if (!renderer->workers) goto error;
 
-extern const unsigned char main_frag_spv[];
-extern unsigned int main_frag_spv_len;
-extern const unsigned char main_vert_spv[];
-extern unsigned int main_vert_spv_len;
+	printf("recording the draws on %u threads\n", renderer->record_workers_len);
+	return;
+error:
+	fprintf(stderr, "could not set up the recording threads, recording on the render thread\n");
+	destroy_record_workers(renderer);
+}
 
-void create_pipeline(struct renderer * renderer) {
+/* false when the scene could not be uploaded, destroy_pipeline() cleans up */
+bool create_pipeline(struct renderer * renderer) {
 
 	uint32_t i;
 
 	vkapi.vkResetDescriptorPool(vkapi.device, renderer->descriptor_pool, 0);
 
-	VkDescriptorSetLayoutBinding dsl_b[1] = {
+	/* the compute pass writes the instance index into the draws */
+	renderer->gpu_cull = options.gpu_cull && vkapi.device_features.drawIndirectFirstInstance;
+	if (options.gpu_cull && !renderer->gpu_cull) {
+		fprintf(stderr, "drawIndirectFirstInstance not supported, culling on the CPU\n");
+	}
+
+	VkDescriptorSetLayoutBinding dsl_b[2] = {
 		{
+			.binding = 0,
 			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 			.descriptorCount = 1,
 			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-		}
+		},
+		{
+			/* instance data, indexed by the instance list entries */
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		},
 	};
 
 	VkDescriptorSetLayoutCreateInfo dsl_ci = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = 1,
+		.bindingCount = 2,
 		.pBindings = dsl_b,
 	};
 
@@ -196,50 +1142,33 @@ void create_pipeline(struct renderer * renderer) {
 	VkVertexInputBindingDescription vertex_binding_descr[] = {
 		{
 			.binding = 0,
-			.stride = sizeof(struct vertex_data),
+			.stride = sizeof(struct packed_vertex),
 			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
 		},
 		{
 			.binding = 1,
-			.stride = sizeof(struct instance_data),
+			.stride = sizeof(uint32_t),
 			.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
 		},
 	};
 
-	VkVertexInputAttributeDescription vertex_attr_descr[16] = {
+	VkVertexInputAttributeDescription vertex_attr_descr[4] = {
 		// in_position
-		{ .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 0, },
+		{ .location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_SNORM, .offset = offsetof(struct packed_vertex, pos), },
 		// in_normal
-		{ .location = 1, .binding = 0, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Vec4), },
-		// in_material
-		{ .location = 2, .binding = 0, .format = VK_FORMAT_R32G32B32A32_UINT,   .offset = 2 * sizeof(Vec4), },
-		// in_flags
-		{ .location = 3, .binding = 0, .format = VK_FORMAT_R32G32B32A32_UINT,   .offset = 2 * sizeof(Vec4) + sizeof(float), },
-
-		// mv_matrix
-		{ .location = 4, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 0, },
-		{ .location = 5, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Vec4), },
-		{ .location = 6, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 2 * sizeof(Vec4), },
-		{ .location = 7, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 3 * sizeof(Vec4), },
-
-		// mvp_matrix
-		{ .location = 8, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Mat4), },
-		{ .location = 9, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Mat4) + sizeof(Vec4), },
-		{ .location = 10, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Mat4) + 2 * sizeof(Vec4), },
-		{ .location = 11, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = sizeof(Mat4) + 3 * sizeof(Vec4), },
-
-		// normal_matrix
-		{ .location = 12, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 2 * sizeof(Mat4), },
-		{ .location = 13, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 2 * sizeof(Mat4) + sizeof(Vec4), },
-		{ .location = 14, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 2 * sizeof(Mat4) + 2 * sizeof(Vec4), },
-		{ .location = 15, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 2 * sizeof(Mat4) + 3 * sizeof(Vec4), },
+		{ .location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(struct packed_vertex, normal), },
+		// in_material_flags
+		{ .location = 2, .binding = 0, .format = VK_FORMAT_R32_UINT, .offset = offsetof(struct packed_vertex, material_flags), },
+
+		// in_instance, the instance list entry
+		{ .location = 4, .binding = 1, .format = VK_FORMAT_R32_UINT, .offset = 0, },
 	};
 
 	VkPipelineVertexInputStateCreateInfo vis_ci = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
 		.vertexBindingDescriptionCount = 2,
 		.pVertexBindingDescriptions = vertex_binding_descr,
-		.vertexAttributeDescriptionCount = 16,
+		.vertexAttributeDescriptionCount = 4,
 		.pVertexAttributeDescriptions = vertex_attr_descr,
 	};
 
@@ -318,194 +1247,686 @@ void create_pipeline(struct renderer * renderer) {
 		.subpass = 0,
 	};
 
-	vkapi.vkCreateGraphicsPipelines(vkapi.device, (VkPipelineCache)VK_NULL_HANDLE, 1, &pipeline_ci, NULL, &renderer->pipeline);
+	bool cache_loaded = false;
+	renderer->pipeline_cache_state = "disabled";
+	if (options.pipeline_cache) {
+		renderer->pipeline_cache = pipeline_cache_load(&cache_loaded);
+		if (renderer->pipeline_cache) {
+			renderer->pipeline_cache_state = cache_loaded ? "loaded" : "empty";
+		}
+	}
 
-	scene_lock(renderer->scene);
+	double start_time = timing_now();
 
-	uint32_t vertices_total = 0;
-	uint32_t instances_total = 0;
-	uint32_t indices_total = 0;
-	for(i = 0; i < renderer->scene->objects_len; i++) {
-		struct scene_object * obj = &renderer->scene->objects[i];
-		struct model * model = obj->model;
-		obj->r.vertex_index = vertices_total;
-		obj->r.instance_index = instances_total;
-		obj->r.index_index = indices_total;
-		vertices_total += model->vertices_len;
-		instances_total += 1;
-		indices_total += model->indices_len;
-	}
+	vkapi.vkCreateGraphicsPipelines(vkapi.device, renderer->pipeline_cache, 1, &pipeline_ci, NULL, &renderer->pipeline);
+	if (renderer->gpu_cull) create_cull_pipeline(renderer);
 
-	renderer->materials_offset = sizeof(struct uniform_buffer);
-	renderer->lights_offset = renderer->materials_offset + sizeof(struct material) * MATERIALS_MAX;
-	renderer->vertex_offset = renderer->lights_offset + sizeof(struct light) * LIGHTS_MAX;
-	renderer->instance_offset = renderer->vertex_offset + sizeof(struct vertex_data) * vertices_total;
-	renderer->index_offset = renderer->instance_offset + sizeof(struct instance_data) * instances_total;
-	uint32_t mem_size = renderer->index_offset + sizeof(uint32_t) * indices_total;
+	printf("pipeline created in %.2f ms (pipeline cache: %s)\n",
+			(timing_now() - start_time) * 1000.0, renderer->pipeline_cache_state);
 
-	renderer->vertex_count = vertices_total;
-	renderer->instance_count = instances_total;
-	renderer->index_count = indices_total;
+	// save right away, we may not get a clean shutdown
+	if (renderer->pipeline_cache && !cache_loaded) {
+		pipeline_cache_save(renderer->pipeline_cache);
+	}
 
-	VkBufferCreateInfo buffer_ci = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = mem_size,
-		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	VkCommandPoolCreateInfo cmd_pool_ci = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = vkapi.g_queue_family,
 	};
 
-	vkapi.vkCreateBuffer(vkapi.device, &buffer_ci, NULL, &renderer->buffer);
+	vkapi.vkCreateCommandPool(vkapi.device, &cmd_pool_ci, NULL, &renderer->command_pool);
 
-	VkMemoryRequirements mem_req;
+	/* the uniform sets, followed by the culling sets */
+	VkDescriptorSetLayout set_layouts[2 * FRAME_LAG_MAX];
+	VkDescriptorSet descriptor_sets[2 * FRAME_LAG_MAX];
+	for(i = 0; i < renderer->frame_lag; i++) {
+		set_layouts[i] = renderer->set_layout;
+		set_layouts[renderer->frame_lag + i] = renderer->cull_set_layout;
+	}
 
-	vkapi.vkGetBufferMemoryRequirements(vkapi.device, renderer->buffer, &mem_req);
+	VkDescriptorSetAllocateInfo ds_ai = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = renderer->descriptor_pool,
+		.descriptorSetCount = renderer->gpu_cull ? 2 * renderer->frame_lag : renderer->frame_lag,
+		.pSetLayouts = set_layouts,
+	};
 
-	for (i = 0; i < vkapi.memory_properties.memoryTypeCount; i++) {
-		if ((vkapi.memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
-			break;
-		}
-	}
+	vkapi.vkAllocateDescriptorSets(vkapi.device, &ds_ai, descriptor_sets);
 
-	if (i == vkapi.memory_properties.memoryTypeCount) {
-		fprintf(stderr, "VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT memory not found!\n");
-		i = 0;
+	for(i = 0; i < renderer->frame_lag; i++) {
+		renderer->frames[i].descriptor_set = descriptor_sets[i];
+		renderer->frames[i].cull_descriptor_set = renderer->gpu_cull ?
+				descriptor_sets[renderer->frame_lag + i] : VK_NULL_HANDLE;
 	}
 
-	VkMemoryAllocateInfo mem_ai = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = mem_req.size,
-		.memoryTypeIndex = i,
+	VkCommandBuffer command_buffers[FRAME_LAG_MAX];
+
+	VkCommandBufferAllocateInfo cmd_buf_ai = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = renderer->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = renderer->frame_lag,
 	};
 
-	vkapi.vkAllocateMemory(vkapi.device, &mem_ai, NULL, &renderer->memory);
+	vkapi.vkAllocateCommandBuffers(vkapi.device, &cmd_buf_ai, command_buffers);
 
-	vkapi.vkMapMemory(vkapi.device, renderer->memory, 0, mem_size, 0, (void *)&renderer->mapped_memory);
+	for(i = 0; i < renderer->frame_lag; i++) {
+		renderer->frames[i].command_buffer = command_buffers[i];
+	}
 
-	memcpy(renderer->mapped_memory + renderer->materials_offset,
-		renderer->scene->materials,
-		sizeof(struct material) * renderer->scene->materials_len
-		);
-	memcpy(renderer->mapped_memory + renderer->lights_offset,
-		renderer->scene->lights,
-		sizeof(struct light) * renderer->scene->lights_len
-		);
+	create_record_workers(renderer);
 
+	renderer->vertex_arena = arena_create(ARENA_INITIAL_VERTICES);
+	renderer->index_arena = arena_create(ARENA_INITIAL_INDICES);
+	renderer->instance_arena = arena_create(ARENA_INITIAL_INSTANCES);
+	renderer->frame_number = 0;
 
+	/* the buffers are filled by the first sync, the later ones only apply the changes */
+	scene_lock(renderer->scene);
 	for(i = 0; i < renderer->scene->objects_len; i++) {
 		struct scene_object * obj = &renderer->scene->objects[i];
-		struct model * model = obj->model;
-
-		memcpy(renderer->mapped_memory + renderer->vertex_offset
-				+ obj->r.vertex_index * sizeof(struct vertex_data),
-			model->vertices,
-			model->vertices_len * sizeof(struct vertex_data)
-			);
-		if (model->indices && model->indices_len) {
-			memcpy(renderer->mapped_memory + renderer->index_offset
-					+ obj->r.index_index * sizeof(uint32_t),
-				model->indices,
-				model->indices_len * sizeof(uint32_t)
-				);
-		}
+		memset(&obj->r, 0, sizeof(obj->r));
+	}
+	for(i = 0; i < renderer->scene->meshes_len; i++) {
+		struct scene_mesh * mesh = &renderer->scene->meshes[i];
+		memset(&mesh->r, 0, sizeof(mesh->r));
+		mesh->s.dirty = 1;
+	}
+	renderer->scene->s.objects_dirty = 1;
+	renderer->view_dirty = true;
+	renderer->scene->s.materials_dirty = 1;
+	if (!renderer->vertex_arena || !renderer->index_arena || !renderer->instance_arena
+			|| !sync_scene(renderer)) {
+		scene_unlock(renderer->scene);
+		fprintf(stderr, "could not upload the scene\n");
+		return false;
 	}
-
 	scene_unlock(renderer->scene);
 
-	vkapi.vkBindBufferMemory(vkapi.device, renderer->buffer, renderer->memory, 0);
+	uint32_t vertices = arena_used(renderer->vertex_arena);
+	printf("mesh vertices: %u, %.1f MiB packed (%.1f MiB unpacked)\n",
+			vertices,
+			vertices * sizeof(struct packed_vertex) / 1048576.0,
+			vertices * sizeof(struct vertex_data) / 1048576.0);
+	return true;
+}
 
-	VkDescriptorSetAllocateInfo ds_ai = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = renderer->descriptor_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &renderer->set_layout,
+/* test the object's bounding sphere, transformed to world space, against the frustum */
+static inline int object_visible(const struct scene_object * obj, const Vec4 planes[6]) {
+
+	const Mat4 * m = &obj->model_matrix;
+	const struct model * mod = obj->model;
+
+	Vec4 center = { mod->bounds_center.x, mod->bounds_center.y, mod->bounds_center.z, 1.0f };
+	center = mat4_mul_vec4(*m, center);
+
+	// the largest axis scale of the model matrix scales the radius
+	float sa = m->a.x * m->a.x + m->a.y * m->a.y + m->a.z * m->a.z;
+	float sb = m->b.x * m->b.x + m->b.y * m->b.y + m->b.z * m->b.z;
+	float sc = m->c.x * m->c.x + m->c.y * m->c.y + m->c.z * m->c.z;
+	if (sb > sa) sa = sb;
+	if (sc > sa) sa = sc;
+
+	return frustum_sphere_visible(planes, (Vec3){ center.x, center.y, center.z },
+					mod->bounds_radius * sqrtf(sa));
+}
+
+/* class of the model matrix with the packed position dequantization folded in */
+static inline enum mat4_class instance_class(const struct scene_object * obj, const struct scene_mesh * mesh) {
+
+	const Vec3 s = mesh->r.pos_scale;
+
+	if (obj->matrix_class == MAT4_CLASS_GENERAL) return MAT4_CLASS_GENERAL;
+	if (s.x != s.y || s.x != s.z) return MAT4_CLASS_SCALED;
+	if (obj->matrix_class == MAT4_CLASS_RIGID && s.x != 1.0f) return MAT4_CLASS_UNIFORM;
+	return obj->matrix_class;
+}
+
+/* squared distance from a point to an axis-aligned box */
+static inline float box_distance2(const Vec4 p, const Vec3 min, const Vec3 max) {
+
+	float dx = p.x < min.x ? min.x - p.x : (p.x > max.x ? p.x - max.x : 0.0f);
+	float dy = p.y < min.y ? min.y - p.y : (p.y > max.y ? p.y - max.y : 0.0f);
+	float dz = p.z < min.z ? min.z - p.z : (p.z > max.z ? p.z - max.z : 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+/* Append a draw of the mesh's indices to the frame's indirect draw list,
+ * for instance_count entries of the instance list */
+static inline void add_draw(struct renderer * renderer, struct frame * frame,
+				const struct scene_mesh * mesh, uint32_t index_count, uint32_t first_index,
+				uint32_t first_instance, uint32_t instance_count) {
+
+	/* sync_scene() makes room for every chunk */
+	if (frame->draws_len == renderer->draw_capacity) return;
+
+	VkDrawIndexedIndirectCommand * draws =
+		(VkDrawIndexedIndirectCommand *)(renderer->mapped_memory + frame->draw_offset);
+	draws[frame->draws_len++] = (VkDrawIndexedIndirectCommand){
+		.indexCount = index_count,
+		.instanceCount = instance_count,
+		.firstIndex = mesh->r.index_index + first_index,
+		.vertexOffset = (int32_t)mesh->r.vertex_index,
+		.firstInstance = first_instance,
 	};
+	frame->instances_drawn += instance_count;
+}
+
+/* Record 'count' draws of the frame's draw list from 'first',
+ * in as few commands as the device allows
+ */
+static void submit_draws(struct renderer * renderer, struct frame * frame, VkCommandBuffer cmd_buffer,
+				uint32_t first, uint32_t count) {
+
+	const VkDrawIndexedIndirectCommand * draws =
+		(const VkDrawIndexedIndirectCommand *)(renderer->mapped_memory + frame->draw_offset);
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	uint32_t i, n, end = first + count;
+
+	if (!vkapi.device_features.drawIndirectFirstInstance) {
+		/* firstInstance must be 0 in indirect draws, use the list for direct ones */
+		for(i = first; i < end; i++) {
+			vkapi.vkCmdDrawIndexed(cmd_buffer, draws[i].indexCount, draws[i].instanceCount, draws[i].firstIndex,
+					draws[i].vertexOffset, draws[i].firstInstance);
+		}
+	}
+	else if (vkapi.device_features.multiDrawIndirect) {
+		uint32_t max_count = vkapi.device_properties.limits.maxDrawIndirectCount;
+		for(i = first; i < end; i += n) {
+			n = end - i;
+			if (n > max_count) n = max_count;
+			vkapi.vkCmdDrawIndexedIndirect(cmd_buffer, renderer->buffer,
+					frame->draw_offset + i * stride, n, stride);
+		}
+	}
+	else {
+		for(i = first; i < end; i++) {
+			vkapi.vkCmdDrawIndexedIndirect(cmd_buffer, renderer->buffer,
+					frame->draw_offset + i * stride, 1, stride);
+		}
+	}
+}
 
-	vkapi.vkAllocateDescriptorSets(vkapi.device, &ds_ai, &renderer->descriptor_set);
+/* The state the draws need, recorded in each command buffer drawing them */
+static void bind_draw_state(struct renderer * renderer, struct frame * frame, struct framebuffer * fb,
+				VkCommandBuffer cmd_buffer) {
 
-	VkDescriptorBufferInfo d_buffer_infos[] = {
+	VkViewport viewports[] = {
 		{
-			.buffer = renderer->buffer,
-			.offset = 0,
-			.range = sizeof(struct uniform_buffer)
-				+ MATERIALS_MAX * sizeof(struct material)
-				+ LIGHTS_MAX * sizeof(struct light),
+			.x = 0,
+			.y = 0,
+			.width = fb->width,
+			.height = fb->height,
+			.minDepth = 0.0f,
+			.maxDepth = 1.0f,
 		}
 	};
 
-	VkWriteDescriptorSet w_descr_sets[] = {
+	vkapi.vkCmdSetViewport(cmd_buffer, 0, 1, viewports);
+
+	VkRect2D scissors[] = {
 		{
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstSet = renderer->descriptor_set,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.dstBinding = 0,
-			.dstArrayElement = 0,
-			.descriptorCount = 1,
-			.pBufferInfo = d_buffer_infos,
+			.offset = { .x = 0, .y = 0 },
+			.extent = { .width = fb->width, .height = fb->height },
 		}
 	};
 
-	vkapi.vkUpdateDescriptorSets(vkapi.device, 1, w_descr_sets, 0, NULL);
+	vkapi.vkCmdSetScissor(cmd_buffer, 0, 1, scissors);
 
-	VkCommandPoolCreateInfo cmd_pool_ci = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-		.queueFamilyIndex = vkapi.g_queue_family,
-	};
+	VkBuffer buffers[] = { renderer->mesh_buffer, renderer->buffer };
+	VkDeviceSize offsets[] = { renderer->vertex_offset, frame->instance_list_offset };
 
-	vkapi.vkCreateCommandPool(vkapi.device, &cmd_pool_ci, NULL, &renderer->command_pool);
+	vkapi.vkCmdBindVertexBuffers(cmd_buffer, 0, 2, buffers, offsets);
 
-	VkFenceCreateInfo fence_ci = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+	if (arena_used(renderer->index_arena)) {
+		vkapi.vkCmdBindIndexBuffer(cmd_buffer, renderer->mesh_buffer, renderer->index_offset, VK_INDEX_TYPE_UINT32);
+	}
+
+	vkapi.vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipeline);
+
+	vkapi.vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipeline_layout,
+				0, 1, &frame->descriptor_set, 0, NULL);
+}
+
+struct record_job {
+	struct renderer * renderer;
+	struct frame * frame;
+	struct framebuffer * fb;
+};
+
+/* Worker thread part of the draw list, recorded into the worker's secondary
+ * command buffer for the frame slot; executed by the primary one.
+ */
+static void record_draws_job(void * arg, uint32_t worker, uint32_t count) {
+
+	struct record_job * job = arg;
+	struct renderer * renderer = job->renderer;
+	struct frame * frame = job->frame;
+	uint32_t first = (uint64_t)frame->draws_len * worker / count;
+	uint32_t end = (uint64_t)frame->draws_len * (worker + 1) / count;
+	VkCommandBuffer cmd_buffer = renderer->record_workers[worker].cmd_buffers[frame - renderer->frames];
+
+	VkCommandBufferInheritanceInfo inheritance_i = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = renderer->render_pass,
+		.subpass = 0,
+		.framebuffer = job->fb->framebuffer,
+		/* the primary buffer's --stats query is active */
+		.pipelineStatistics = frame->query_pool ? STATS_QUERY_FLAGS : 0,
 	};
 
-	vkapi.vkCreateFence(vkapi.device, &fence_ci, NULL, &renderer->cmd_buf_fence);
+	VkCommandBufferBeginInfo cmd_buf_bi = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+		.pInheritanceInfo = &inheritance_i,
+	};
 
-	VkCommandBufferAllocateInfo cmd_buf_ai = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = renderer->command_pool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = 1,
+	vkapi.vkBeginCommandBuffer(cmd_buffer, &cmd_buf_bi);
+	bind_draw_state(renderer, frame, job->fb, cmd_buffer);
+	submit_draws(renderer, frame, cmd_buffer, first, end - first);
+	vkapi.vkEndCommandBuffer(cmd_buffer);
+}
+
+/* Number of the recording threads to split the frame's draws between */
+static uint32_t record_threads(struct renderer * renderer, struct frame * frame) {
+
+	uint32_t count = renderer->record_workers_len;
+	if (count > frame->draws_len) count = frame->draws_len;
+	return count ? count : 1;
+}
+
+/* Record the frame's draws on 'count' threads and execute them from the primary buffer */
+static void record_draws_parallel(struct renderer * renderer, struct frame * frame, struct framebuffer * fb,
+				VkCommandBuffer cmd_buffer, uint32_t count) {
+
+	uint32_t i;
+	VkCommandBuffer secondary[RECORD_THREADS_MAX];
+	struct record_job job = { .renderer = renderer, .frame = frame, .fb = fb };
+
+	worker_pool_run(renderer->workers, count, record_draws_job, &job);
+
+	for(i = 0; i < count; i++) {
+		secondary[i] = renderer->record_workers[i].cmd_buffers[frame - renderer->frames];
+	}
+	vkapi.vkCmdExecuteCommands(cmd_buffer, count, secondary);
+}
+
+/* --record-bench: time recording the frame's draws on 1 to --threads threads.
+ * The secondary buffers are re-recorded each run, none of the runs is submitted.
+ */
+static void record_bench(struct renderer * renderer, struct frame * frame, struct framebuffer * fb) {
+
+	uint32_t count, i;
+	struct record_job job = { .renderer = renderer, .frame = frame, .fb = fb };
+	double single = 0.0;
+
+	printf("record bench: %u draws, %u runs per thread count\n", frame->draws_len, RECORD_BENCH_RUNS);
+	for(count = 1; count <= renderer->record_workers_len; count++) {
+		double start_time = timing_now();
+		for(i = 0; i < RECORD_BENCH_RUNS; i++) {
+			worker_pool_run(renderer->workers, count, record_draws_job, &job);
+		}
+		double ms = (timing_now() - start_time) * 1000.0 / RECORD_BENCH_RUNS;
+		if (count == 1) single = ms;
+		printf("%3u threads: %8.3f ms per frame, speedup %.2f\n", count, ms, ms > 0.0 ? single / ms : 0.0);
+	}
+}
+
+/* Walk the model's LOD quadtree and draw the chunks selected for the eye position,
+ * with the instance list entry 'instance'.
+ * A node is replaced by its children when the eye is within its split distance,
+ * so the detail drops with distance and the number of chunks drawn stays
+ * roughly constant, whatever the size of the model.
+ */
+static void draw_lod_chunks(struct renderer * renderer, struct frame * frame,
+				const struct scene_object * obj, uint32_t instance,
+				const Vec4 planes[6], const Vec4 eye) {
+
+	const struct model * mod = obj->model;
+	const struct scene_mesh * mesh = &renderer->scene->meshes[obj->mesh];
+	uint32_t stack[128];
+	uint32_t stack_len = 0;
+	uint32_t k;
+
+	stack[stack_len++] = mod->lod_root;
+	while(stack_len) {
+		const struct model_lod_node * node = &mod->lod_nodes[stack[--stack_len]];
+		const struct model_chunk * chunk = &mod->chunks[node->chunk];
+
+		frame->chunks_total++;
+		if (!frustum_aabb_visible(planes, chunk->bounds_min, chunk->bounds_max)) {
+			frame->chunks_culled++;
+			continue;
+		}
+		if (node->children[0] != MODEL_LOD_NONE && stack_len + 4 <= 128
+				&& box_distance2(eye, chunk->bounds_min, chunk->bounds_max)
+					< node->split_distance * node->split_distance) {
+			for(k = 0; k < 4; k++) {
+				if (node->children[k] != MODEL_LOD_NONE) stack[stack_len++] = node->children[k];
+			}
+			continue;
+		}
+		add_draw(renderer, frame, mesh, chunk->index_count, chunk->index_offset, instance, 1);
+	}
+}
+
+/* a box corner, in the packed vertex coordinates */
+static inline Vec4 packed_point(const Vec3 p, const struct scene_mesh * mesh, float w) {
+
+	const Vec3 o = mesh->r.pos_offset, s = mesh->r.pos_scale;
+	return (Vec4){ (p.x - o.x) / s.x, (p.y - o.y) / s.y, (p.z - o.z) / s.z, w };
+}
+
+static inline void add_candidate(struct renderer * renderer, struct frame * frame,
+				const struct scene_object * obj, const struct model_chunk * chunk,
+				float split_distance, const struct model_chunk * parent, float parent_split) {
+
+	/* sync_scene() makes room for every chunk */
+	if (frame->candidates_len == renderer->draw_capacity) return;
+
+	struct cull_candidate * candidates = (struct cull_candidate *)(renderer->mapped_memory
+					+ frame->cull_offset + sizeof(struct cull_header));
+	struct cull_candidate * c = &candidates[frame->candidates_len++];
+	const struct scene_mesh * mesh = &renderer->scene->meshes[obj->mesh];
+
+	c->bounds_min = packed_point(chunk->bounds_min, mesh, split_distance);
+	c->bounds_max = packed_point(chunk->bounds_max, mesh, parent ? parent_split : -1.0f);
+	if (parent) {
+		c->parent_min = packed_point(parent->bounds_min, mesh, 0.0f);
+		c->parent_max = packed_point(parent->bounds_max, mesh, 0.0f);
+	}
+	else {
+		c->parent_min = c->parent_max = (Vec4){ 0.0f, 0.0f, 0.0f, 0.0f };
+	}
+	c->pos_scale = (Vec4){ mesh->r.pos_scale.x, mesh->r.pos_scale.y, mesh->r.pos_scale.z, 0.0f };
+	c->draw[0] = chunk->index_count;
+	c->draw[1] = mesh->r.index_index + chunk->index_offset;
+	c->draw[2] = mesh->r.vertex_index;
+	/* the instance list is the identity with --gpu-cull */
+	c->draw[3] = obj->r.instance_index;
+}
+
+/* Write the draws the compute pass chooses from into the frame's culling region:
+ * every LOD node, with its parent's box for the LOD selection, every chunk,
+ * or the bounding box of the object. They only change with the objects and meshes.
+ * Must be called with the scene locked.
+ */
+static void build_candidates(struct renderer * renderer, struct frame * frame) {
+
+	struct scene * scene = renderer->scene;
+	uint32_t i, j, k;
+
+	frame->candidates_len = 0;
+	for(i = 0; i < scene->objects_len; i++) {
+		const struct scene_object * obj = &scene->objects[i];
+		const struct model * mod = obj->model;
+
+		if (!mod) continue;
+
+		if (mod->lod_nodes_len) {
+			uint32_t stack[128], parents[128];
+			uint32_t stack_len = 0;
+
+			stack[stack_len] = mod->lod_root;
+			parents[stack_len++] = MODEL_LOD_NONE;
+			while(stack_len) {
+				stack_len--;
+				const struct model_lod_node * node = &mod->lod_nodes[stack[stack_len]];
+				const struct model_lod_node * parent = NULL;
+				if (parents[stack_len] != MODEL_LOD_NONE) parent = &mod->lod_nodes[parents[stack_len]];
+
+				add_candidate(renderer, frame, obj, &mod->chunks[node->chunk],
+						node->children[0] != MODEL_LOD_NONE ? node->split_distance : 0.0f,
+						parent ? &mod->chunks[parent->chunk] : NULL,
+						parent ? parent->split_distance : 0.0f);
+
+				if (node->children[0] == MODEL_LOD_NONE || stack_len + 4 > 128) continue;
+				for(k = 0; k < 4; k++) {
+					if (node->children[k] == MODEL_LOD_NONE) continue;
+					parents[stack_len] = node - mod->lod_nodes;
+					stack[stack_len++] = node->children[k];
+				}
+			}
+		}
+		else if (mod->chunks_len) {
+			for(j = 0; j < mod->chunks_len; j++) {
+				add_candidate(renderer, frame, obj, &mod->chunks[j], 0.0f, NULL, 0.0f);
+			}
+		}
+		else {
+			/* the whole mesh, in the box around the bounding sphere */
+			Vec3 c = mod->bounds_center;
+			float r = mod->bounds_radius;
+			struct model_chunk whole = {
+				.index_offset = 0,
+				.index_count = scene->meshes[obj->mesh].r.indices_len,
+				.bounds_min = { c.x - r, c.y - r, c.z - r },
+				.bounds_max = { c.x + r, c.y + r, c.z + r },
+			};
+			add_candidate(renderer, frame, obj, &whole, 0.0f, NULL, 0.0f);
+		}
+	}
+}
+
+/* Should the culled draws be compacted and drawn with the count the compute
+ * pass writes? Otherwise every candidate gets a draw, the culled ones with no
+ * instances.
+ */
+static inline bool compact_draws(const struct frame * frame) {
+
+	return vkapi.draw_indirect_count && vkapi.device_features.multiDrawIndirect
+		&& frame->candidates_len <= vkapi.device_properties.limits.maxDrawIndirectCount;
+}
+
+/* Record the culling compute pass, writing the frame's indirect draws.
+ * The view space frustum planes are transformed with each instance's
+ * mv_matrix on the GPU, so nothing here depends on the object count.
+ */
+static void record_culling(struct renderer * renderer, struct frame * frame, VkCommandBuffer cmd_buffer) {
+
+	struct cull_header * header = (struct cull_header *)(renderer->mapped_memory + frame->cull_offset);
+	header->draw_count = 0;
+	header->culled_count = 0;
+	frame->stats_buffer = renderer->buffer;
+
+	if (!frame->candidates_len) return;
+
+	struct cull_push_constants push_constants = {
+		.candidates_len = frame->candidates_len,
+		.compact = compact_draws(frame),
+	};
+	mat4_frustum_planes(push_constants.planes, renderer->p_matrix);
+
+	vkapi.vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderer->cull_pipeline);
+	vkapi.vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderer->cull_pipeline_layout,
+				0, 1, &frame->cull_descriptor_set, 0, NULL);
+	vkapi.vkCmdPushConstants(cmd_buffer, renderer->cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+				0, sizeof(push_constants), &push_constants);
+	vkapi.vkCmdDispatch(cmd_buffer, (frame->candidates_len + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	const VkMemoryBarrier draws_b = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
 	};
 
-	vkapi.vkAllocateCommandBuffers(vkapi.device, &cmd_buf_ai, &renderer->command_buffer);
+	vkapi.vkCmdPipelineBarrier(cmd_buffer,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+					0,
+					1, &draws_b, 0, NULL, 0, NULL);
+}
+
+/* Record the draws written by the culling compute pass */
+static void submit_culled_draws(struct renderer * renderer, struct frame * frame, VkCommandBuffer cmd_buffer) {
+
+	if (!frame->candidates_len) return;
+
+	if (compact_draws(frame)) {
+		vkapi.vkCmdDrawIndexedIndirectCountKHR(cmd_buffer, renderer->buffer, frame->draw_offset,
+				renderer->buffer, frame->cull_offset + offsetof(struct cull_header, draw_count),
+				frame->candidates_len, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else {
+		frame->draws_len = frame->candidates_len;
+		submit_draws(renderer, frame, cmd_buffer, 0, frame->draws_len);
+	}
+}
+
+/* The eye position and direction at 'now', between the last two world ticks.
+ * The view is interpolated one tick behind, so the frames move smoothly from the
+ * previous tick to the latest one whatever the tick and frame rates are.
+ * With --extrapolate it is projected from the last tick to 'now' instead,
+ * no latency but an overshoot when the movement stops.
+ */
+static void view_eye_at(const struct scene_view * view, double now, Vec3 * eye_pos, Vec3 * eye_dir) {
+
+	double tick = view->time - view->prev_time;
+	float alpha = 1.0f, alpha_max = options.extrapolate ? 2.0f : 1.0f;
+
+	if (tick > 0.0) {
+		double t = options.extrapolate ? now : now - tick;
+		alpha = (t - view->prev_time) / tick;
+		if (alpha < 0.0f) alpha = 0.0f;
+		else if (alpha > alpha_max) alpha = alpha_max;
+	}
+	*eye_pos = vec3_add(view->prev_eye_pos, vec3_scale(vec3_sub(view->eye_pos, view->prev_eye_pos), alpha));
+	/* not normalized, mat4_view() does that */
+	*eye_dir = vec3_add(view->prev_eye_dir, vec3_scale(vec3_sub(view->eye_dir, view->prev_eye_dir), alpha));
 }
 
-void render_scene(struct renderer * renderer, uint32_t image_index) {
+bool render_scene(struct renderer * renderer, struct frame * frame, uint32_t image_index) {
 
 	VkResult result;
 	struct uniform_buffer uniform_buffer;
 	uint32_t i;
 	struct framebuffer * fb = &renderer->framebuffers[image_index];
+	uint32_t frame_bit = 1u << (frame - renderer->frames);
+
+	/* the newest view from the world thread, its tick never blocks the frame */
+	Vec3 eye_pos, eye_dir;
+	view_eye_at(scene_get_view(renderer->scene), timing_now(), &eye_pos, &eye_dir);
+	if (memcmp(&eye_pos, &renderer->eye_pos, sizeof(eye_pos)) || memcmp(&eye_dir, &renderer->eye_dir, sizeof(eye_dir))) {
+		renderer->eye_pos = eye_pos;
+		renderer->eye_dir = eye_dir;
+		renderer->view_dirty = true;
+	}
+
+	scene_lock(renderer->scene);
+	if (!sync_scene(renderer)) {
+		scene_unlock(renderer->scene);
+		fprintf(stderr, "could not update the scene buffers\n");
+		return false;
+	}
+	if (frame->descriptor_dirty) update_frame_descriptors(renderer, frame);
 
 	Vec3 up = {0.0f, -1.0f, 0.0};
 
-	renderer->p_matrix = mat4_perspective((float)deg_to_rad(45.0f), 1.0f, 1.0f, 500.0f);
+	renderer->p_matrix = mat4_perspective((float)deg_to_rad(45.0f), 1.0f, 1.0f, 500.0f);
+
+	renderer->v_matrix = mat4_view(renderer->eye_pos, renderer->eye_dir, up);
+
+	Vec4 planes[6];
+	mat4_frustum_planes(planes, mat4_mul(renderer->p_matrix, renderer->v_matrix));
+
+	uint32_t class_count[MAT4_CLASS_COUNT] = { 0 }, class_start[MAT4_CLASS_COUNT], class_end[MAT4_CLASS_COUNT];
+	enum mat4_class cls;
+
+	frame->objects_total = 0;
+	frame->objects_culled = 0;
+	frame->chunks_total = 0;
+	frame->chunks_culled = 0;
+	frame->instances_written = 0;
+	frame->instances_drawn = 0;
+	frame->draws_len = 0;
+
+	/* only the visible instances whose data in this frame slot is out of date
+	 * are written, a hidden one is written when it shows up again */
+	for(i = 0; i < renderer->scene->objects_len; i++) {
+		struct scene_object * obj = &renderer->scene->objects[i];
+
+		/* removed */
+		if (!obj->model) {
+			obj->r.visible = 0;
+			continue;
+		}
+		frame->objects_total++;
+
+		/* with --gpu-cull every instance is written, the compute pass culls them */
+		obj->r.visible = renderer->gpu_cull || object_visible(obj, planes);
+		if (!obj->r.visible) {
+			frame->objects_culled++;
+			continue;
+		}
+		if (obj->r.frames_valid & frame_bit) continue;
+		class_count[instance_class(obj, &renderer->scene->meshes[obj->mesh])]++;
+	}
 
-	renderer->v_matrix = mat4_view(renderer->scene->eye_pos, renderer->scene->eye_dir, up);
+	/* batches by class, the cheap normal matrices are not mixed with the general ones */
+	uint32_t start = 0;
+	for(cls = 0; cls < MAT4_CLASS_COUNT; cls++) {
+		class_start[cls] = class_end[cls] = start;
+		start += class_count[cls];
+	}
 
 	for(i = 0; i < renderer->scene->objects_len; i++) {
 		struct scene_object * obj = &renderer->scene->objects[i];
-		struct instance_data * inst = (struct instance_data *)(
-			renderer->mapped_memory + renderer->instance_offset +
-			obj->r.instance_index * sizeof(struct instance_data));
 
-		inst->mv_matrix = mat4_mul(renderer->v_matrix, obj->model_matrix);
-		inst->mvp_matrix = mat4_mul(renderer->p_matrix, inst->mv_matrix);
+		if (!obj->r.visible || (obj->r.frames_valid & frame_bit)) continue;
+		obj->r.frames_valid |= frame_bit;
+
+		/* fold the packed position dequantization into the model matrix,
+		 * the packed normals are pre-scaled to match */
+		const struct scene_mesh * mesh = &renderer->scene->meshes[obj->mesh];
+		Mat4 m = obj->model_matrix;
+		Vec3 o = mesh->r.pos_offset, s = mesh->r.pos_scale;
+		m.d = vec4_add(m.d, vec4_scale(m.a, o.x));
+		m.d = vec4_add(m.d, vec4_scale(m.b, o.y));
+		m.d = vec4_add(m.d, vec4_scale(m.c, o.z));
+		m.a = vec4_scale(m.a, s.x);
+		m.b = vec4_scale(m.b, s.y);
+		m.c = vec4_scale(m.c, s.z);
+
+		uint32_t k = class_end[instance_class(obj, mesh)]++;
+		renderer->batch_models[k] = m;
+		renderer->batch_index[k] = obj->r.instance_index;
+	}
+
+	for(cls = 0; cls < MAT4_CLASS_COUNT; cls++) {
+		if (!class_count[cls]) continue;
+		frame->instances_written += class_count[cls];
+		mat4_batch_instances(renderer->batch_models + class_start[cls],
+				renderer->batch_index + class_start[cls], class_count[cls], cls,
+				renderer->v_matrix, renderer->p_matrix,
+				renderer->mapped_memory + frame->instance_offset,
+				sizeof(struct instance_data));
+	}
+
+	if (renderer->gpu_cull && !(renderer->candidates_valid & frame_bit)) {
+		build_candidates(renderer, frame);
+		renderer->candidates_valid |= frame_bit;
+	}
 
-		Mat4 imv_matrix = mat4_invert(inst->mv_matrix);
-		inst->normal_matrix = mat4_transpose(imv_matrix);
+	if (!(renderer->materials_valid & frame_bit)) {
+		unsigned char * uniforms = renderer->mapped_memory + frame->uniform_offset;
+		memcpy(uniforms + renderer->materials_offset,
+			renderer->scene->materials,
+			sizeof(struct material) * renderer->scene->materials_len
+			);
+		memcpy(uniforms + renderer->lights_offset,
+			renderer->scene->lights,
+			sizeof(struct light) * renderer->scene->lights_len
+			);
+		renderer->materials_valid |= frame_bit;
 	}
 
 	uniform_buffer.ambient_light = renderer->scene->ambient_light;
 	uniform_buffer.v_matrix = renderer->v_matrix;
 
-	memcpy(renderer->mapped_memory, &uniform_buffer, sizeof(uniform_buffer));
-
-	if (renderer->cmd_buf_fence_ready) {
-		vkapi.vkWaitForFences(vkapi.device, 1, &renderer->cmd_buf_fence, VK_TRUE, UINT64_MAX);
-		vkapi.vkResetFences(vkapi.device, 1, &renderer->cmd_buf_fence);
-	}
+	memcpy(renderer->mapped_memory + frame->uniform_offset, &uniform_buffer, sizeof(uniform_buffer));
 
-	VkCommandBuffer cmd_buffer = renderer->command_buffer;
+	VkCommandBuffer cmd_buffer = frame->command_buffer;
 	vkapi.vkResetCommandBuffer(cmd_buffer, 0);
 
 	VkCommandBufferBeginInfo cmd_buf_bi = {
@@ -514,12 +1935,14 @@ void render_scene(struct renderer * renderer, uint32_t image_index) {
 
 	vkapi.vkBeginCommandBuffer(cmd_buffer, &cmd_buf_bi);
 
+	if (renderer->gpu_cull) record_culling(renderer, frame, cmd_buffer);
+
 	int same_queue = vkapi.p_queue_family == vkapi.g_queue_family;
 	const VkImageMemoryBarrier acquire_image_b = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 		.srcAccessMask = fb->image_initialized ? VK_ACCESS_MEMORY_READ_BIT : 0,
 		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		.oldLayout = fb->image_initialized ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_UNDEFINED,
+		.oldLayout = fb->image_initialized ? renderer->present_layout : VK_IMAGE_LAYOUT_UNDEFINED,
 		.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
 		.srcQueueFamilyIndex = same_queue ? VK_QUEUE_FAMILY_IGNORED : vkapi.p_queue_family,
 		.dstQueueFamilyIndex = same_queue ? VK_QUEUE_FAMILY_IGNORED : vkapi.g_queue_family,
@@ -540,33 +1963,11 @@ void render_scene(struct renderer * renderer, uint32_t image_index) {
 
 	fb->image_initialized = true;
 
-	if (fb->query_pool) {
-		vkapi.vkCmdResetQueryPool(cmd_buffer, fb->query_pool, 0, 1);
-		vkapi.vkCmdBeginQuery(cmd_buffer, fb->query_pool, 0, 0);
+	if (frame->query_pool) {
+		vkapi.vkCmdResetQueryPool(cmd_buffer, frame->query_pool, 0, 1);
+		vkapi.vkCmdBeginQuery(cmd_buffer, frame->query_pool, 0, 0);
 	}
 
-	VkViewport viewports[] = {
-		{
-			.x = 0,
-			.y = 0,
-			.width = fb->width,
-			.height = fb->height,
-			.minDepth = 0.0f,
-			.maxDepth = 1.0f,
-		}
-	};
-
-	vkapi.vkCmdSetViewport(cmd_buffer, 0, 1, viewports);
-
-	VkRect2D scissors[] = {
-		{
-			.offset = { .x = 0, .y = 0 },
-			.extent = { .width = fb->width, .height = fb->height },
-		}
-	};
-
-	vkapi.vkCmdSetScissor(cmd_buffer, 0, 1, scissors);
-
 	VkClearValue clear_values[] = {
 		{ .color = { .float32 = { 0.25f, 0.25f, 1.0f, 1.0f } } },
 		{ .depthStencil = { .depth = 1.0f } }
@@ -581,60 +1982,136 @@ void render_scene(struct renderer * renderer, uint32_t image_index) {
 		.pClearValues = clear_values,
 	};
 
-	vkapi.vkCmdBeginRenderPass(cmd_buffer, &render_pass_bi, VK_SUBPASS_CONTENTS_INLINE);
+	/* with the recording threads, the subpass only executes their secondary buffers */
+	vkapi.vkCmdBeginRenderPass(cmd_buffer, &render_pass_bi,
+			renderer->workers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
 
 	const const VkPipelineStageFlags dst_s_mask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	const VkSubmitInfo submits[] = {
 		{
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &renderer->image_acquired_sem,
+		.waitSemaphoreCount = renderer->headless ? 0 : 1,
+		.pWaitSemaphores = &frame->image_acquired_sem,
 		.pWaitDstStageMask = &dst_s_mask,
 		.commandBufferCount = 1,
 		.pCommandBuffers = &cmd_buffer,
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = &renderer->rendering_complete_sem,
+		.signalSemaphoreCount = renderer->headless ? 0 : 1,
+		.pSignalSemaphores = &frame->rendering_complete_sem,
 		},
 	};
 
-	VkBuffer buffers[] = { renderer->buffer, renderer->buffer };
-	VkDeviceSize offsets[] = { renderer->vertex_offset, renderer->instance_offset };
+	if (!renderer->workers) bind_draw_state(renderer, frame, fb, cmd_buffer);
 
-	vkapi.vkCmdBindVertexBuffers(cmd_buffer, 0, 2, buffers, offsets);
-
-	if (renderer->index_count) {
-		vkapi.vkCmdBindIndexBuffer(cmd_buffer, renderer->buffer, renderer->index_offset, VK_INDEX_TYPE_UINT32);
+	if (renderer->gpu_cull) {
+		submit_culled_draws(renderer, frame, cmd_buffer);
 	}
+	else {
+		struct scene * scene = renderer->scene;
+		uint32_t * instance_list = (uint32_t *)(renderer->mapped_memory + frame->instance_list_offset);
+		uint32_t list_len = 0;
+
+		/* the visible objects of each unchunked mesh get a range of the instance
+		 * list and are drawn with one instanced draw, the chunked ones are drawn
+		 * chunk by chunk, with an entry each after the ranges */
+		for(i = 0; i < scene->meshes_len; i++) {
+			scene->meshes[i].r.instances_len = 0;
+		}
+		for(i = 0; i < scene->objects_len; i++) {
+			struct scene_object * obj = &scene->objects[i];
+			if (!obj->r.visible || obj->model->chunks_len) continue;
+			scene->meshes[obj->mesh].r.instances_len++;
+		}
+		for(i = 0; i < scene->meshes_len; i++) {
+			struct scene_mesh * mesh = &scene->meshes[i];
+			mesh->r.instances_start = list_len;
+			list_len += mesh->r.instances_len;
+			mesh->r.instances_len = 0;
+		}
 
-	vkapi.vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipeline);
+		for(i = 0; i < scene->objects_len; i++) {
+			struct scene_object * obj = &scene->objects[i];
+			struct scene_mesh * mesh = &scene->meshes[obj->mesh];
+			struct model * mod = obj->model;
 
-	vkapi.vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipeline_layout,
-				0, 1, &renderer->descriptor_set, 0, NULL);
+			if (!obj->r.visible) continue;
 
-	for(i = 0; i < renderer->scene->objects_len; i++) {
-		struct scene_object * obj = &renderer->scene->objects[i];
-		struct model * mod = obj->model;
+			if (!mod->chunks_len) {
+				instance_list[mesh->r.instances_start + mesh->r.instances_len++] = obj->r.instance_index;
+				continue;
+			}
+			uint32_t instance = list_len++;
+			instance_list[instance] = obj->r.instance_index;
+
+			if (mod->lod_nodes_len) {
+				uint32_t k;
+				Vec4 model_planes[6];
+				// frustum planes and eye position in model coordinates
+				Mat4 tm = mat4_transpose(obj->model_matrix);
+				for(k = 0; k < 6; k++) {
+					model_planes[k] = mat4_mul_vec4(tm, planes[k]);
+				}
+				Vec3 eye = renderer->eye_pos;
+				Mat4 im = (obj->matrix_class == MAT4_CLASS_GENERAL) ?
+					mat4_invert(obj->model_matrix) : mat4_invert_orthogonal(obj->model_matrix);
+				Vec4 model_eye = mat4_mul_vec4(im, (Vec4){ eye.x, eye.y, eye.z, 1.0f });
 
-		if (mod->indices) {
-			vkapi.vkCmdDrawIndexed(cmd_buffer, mod->indices_len, 1, obj->r.index_index, obj->r.vertex_index, obj->r.instance_index);
+				draw_lod_chunks(renderer, frame, obj, instance, model_planes, model_eye);
+			}
+			else {
+				uint32_t j, k;
+				Vec4 model_planes[6];
+				// frustum planes in model coordinates, to test the chunk boxes directly
+				Mat4 tm = mat4_transpose(obj->model_matrix);
+				for(k = 0; k < 6; k++) {
+					model_planes[k] = mat4_mul_vec4(tm, planes[k]);
+				}
+				frame->chunks_total += mod->chunks_len;
+				for(j = 0; j < mod->chunks_len; j++) {
+					const struct model_chunk * chunk = &mod->chunks[j];
+					if (!frustum_aabb_visible(model_planes, chunk->bounds_min, chunk->bounds_max)) {
+						frame->chunks_culled++;
+						continue;
+					}
+					add_draw(renderer, frame, mesh, chunk->index_count, chunk->index_offset, instance, 1);
+				}
+			}
+		}
+
+		for(i = 0; i < scene->meshes_len; i++) {
+			struct scene_mesh * mesh = &scene->meshes[i];
+			if (!mesh->r.instances_len) continue;
+			add_draw(renderer, frame, mesh, mesh->r.indices_len, 0,
+					mesh->r.instances_start, mesh->r.instances_len);
+		}
+
+		if (renderer->workers) {
+			if (options.record_bench) {
+				record_bench(renderer, frame, fb);
+				options.record_bench = false;
+				request_exit();
+			}
+			record_draws_parallel(renderer, frame, fb, cmd_buffer, record_threads(renderer, frame));
 		}
 		else {
-			vkapi.vkCmdDraw(cmd_buffer, mod->vertices_len, 1, obj->r.vertex_index, obj->r.instance_index);
+			submit_draws(renderer, frame, cmd_buffer, 0, frame->draws_len);
 		}
 	}
 
+	scene_unlock(renderer->scene);
+
 	vkapi.vkCmdEndRenderPass(cmd_buffer);
 
-	if (fb->query_pool) {
-		vkapi.vkCmdEndQuery(cmd_buffer, fb->query_pool, 0);
+	if (frame->query_pool) {
+		vkapi.vkCmdEndQuery(cmd_buffer, frame->query_pool, 0);
 	}
+	frame->stats_pending = options.stats;
 
 	const VkImageMemoryBarrier release_image_b = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 		.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
 		.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-		.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		.newLayout = renderer->present_layout,
 		.srcQueueFamilyIndex = same_queue ? VK_QUEUE_FAMILY_IGNORED : vkapi.g_queue_family,
 		.dstQueueFamilyIndex = same_queue ? VK_QUEUE_FAMILY_IGNORED : vkapi.p_queue_family,
 		.image = renderer->swapchain_images[image_index],
@@ -654,15 +2131,26 @@ void render_scene(struct renderer * renderer, uint32_t image_index) {
 
 	vkapi.vkEndCommandBuffer(cmd_buffer);
 
-	result = vkapi.vkQueueSubmit(vkapi.g_queue, 1, submits, renderer->cmd_buf_fence);
+	vkapi.vkResetFences(vkapi.device, 1, &frame->fence);
+
+	result = vkapi.vkQueueSubmit(vkapi.g_queue, 1, submits, frame->fence);
 	if (result != VK_SUCCESS) {
+		/* the fence was reset and nothing will signal it, the slot is unusable */
 		fprintf(stderr, "vkQueueSubmit failed: %i\n", result);
+		return false;
 	}
-	renderer->cmd_buf_fence_ready = 1;
+	renderer->frame_number++;
+	return true;
 }
 
 void destroy_pipeline(struct renderer * renderer) {
 
+	/* the device is idle, nothing retired is in use */
+	release_retired(renderer, UINT64_MAX);
+	free(renderer->retired);
+	renderer->retired = NULL;
+	renderer->retired_size = 0;
+	destroy_record_workers(renderer);
 	if (renderer->command_pool) vkapi.vkDestroyCommandPool(vkapi.device, renderer->command_pool, NULL);
 	renderer->command_pool = NULL;
 	if (renderer->buffer) vkapi.vkDestroyBuffer(vkapi.device, renderer->buffer, NULL);
@@ -673,12 +2161,18 @@ void destroy_pipeline(struct renderer * renderer) {
 	}
 	renderer->memory = NULL;
 	renderer->mapped_memory = NULL;
+	if (renderer->mesh_buffer) vkapi.vkDestroyBuffer(vkapi.device, renderer->mesh_buffer, NULL);
+	renderer->mesh_buffer = NULL;
+	if (renderer->mesh_memory) vkapi.vkFreeMemory(vkapi.device, renderer->mesh_memory, NULL);
+	renderer->mesh_memory = NULL;
 	if (renderer->framebuffer_memory) {
 		vkapi.vkFreeMemory(vkapi.device, renderer->framebuffer_memory, NULL);
 	}
 	renderer->framebuffer_memory = NULL;
 	if (renderer->pipeline) vkapi.vkDestroyPipeline(vkapi.device, renderer->pipeline, NULL);
 	renderer->pipeline = NULL;
+	if (renderer->pipeline_cache) vkapi.vkDestroyPipelineCache(vkapi.device, renderer->pipeline_cache, NULL);
+	renderer->pipeline_cache = NULL;
 	if (renderer->vs_module) vkapi.vkDestroyShaderModule(vkapi.device, renderer->vs_module, NULL);
 	renderer->vs_module = NULL;
 	if (renderer->fs_module) vkapi.vkDestroyShaderModule(vkapi.device, renderer->fs_module, NULL);
@@ -687,8 +2181,24 @@ void destroy_pipeline(struct renderer * renderer) {
 	renderer->pipeline_layout = NULL;
 	if (renderer->set_layout) vkapi.vkDestroyDescriptorSetLayout(vkapi.device, renderer->set_layout, NULL);
 	renderer->set_layout = NULL;
-	if (renderer->cmd_buf_fence) vkapi.vkDestroyFence(vkapi.device, renderer->cmd_buf_fence, NULL);
-	renderer->cmd_buf_fence = NULL;
+	if (renderer->cull_pipeline) vkapi.vkDestroyPipeline(vkapi.device, renderer->cull_pipeline, NULL);
+	renderer->cull_pipeline = NULL;
+	if (renderer->cs_module) vkapi.vkDestroyShaderModule(vkapi.device, renderer->cs_module, NULL);
+	renderer->cs_module = NULL;
+	if (renderer->cull_pipeline_layout) vkapi.vkDestroyPipelineLayout(vkapi.device, renderer->cull_pipeline_layout, NULL);
+	renderer->cull_pipeline_layout = NULL;
+	if (renderer->cull_set_layout) vkapi.vkDestroyDescriptorSetLayout(vkapi.device, renderer->cull_set_layout, NULL);
+	renderer->cull_set_layout = NULL;
+	free(renderer->batch_models);
+	renderer->batch_models = NULL;
+	free(renderer->batch_index);
+	renderer->batch_index = NULL;
+	arena_destroy(renderer->vertex_arena);
+	renderer->vertex_arena = NULL;
+	arena_destroy(renderer->index_arena);
+	renderer->index_arena = NULL;
+	arena_destroy(renderer->instance_arena);
+	renderer->instance_arena = NULL;
 }
 
 VkResult render_init(struct renderer * renderer) {
@@ -763,17 +2273,22 @@ VkResult render_init(struct renderer * renderer) {
 		goto error;
 	}
 
+	/* a uniform set and a culling set per frame */
 	VkDescriptorPoolSize dpool_sizes[] = {
 		{
 			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.descriptorCount = 5,
+			.descriptorCount = FRAME_LAG_MAX,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 4 * FRAME_LAG_MAX,
 		},
 	};
 
 	VkDescriptorPoolCreateInfo dpool_ci = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = 10,
-		.poolSizeCount = 1,
+		.maxSets = 2 * FRAME_LAG_MAX,
+		.poolSizeCount = 2,
 		.pPoolSizes = dpool_sizes,
 	};
 
@@ -889,39 +2404,8 @@ static uint32_t create_swapchain(struct renderer *renderer) {
 	renderer->swapchain = swapchain;
 	renderer->swapchain_image_count = image_count;
 
-	const VkSemaphoreCreateInfo sem_ci = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-	};
-
-	if (renderer->image_acquired_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->image_acquired_sem, NULL);
-		renderer->image_acquired_sem = VK_NULL_HANDLE;
-	}
-	result = vkapi.vkCreateSemaphore(vkapi.device, &sem_ci, NULL, &renderer->image_acquired_sem);
-	if (result != VK_SUCCESS) {
-		fprintf(stderr, "vkCreateSemaphore failed: %i\n", result);
-		goto error;
-	}
-	if (renderer->rendering_complete_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->rendering_complete_sem, NULL);
-		renderer->rendering_complete_sem = VK_NULL_HANDLE;
-	}
-	result = vkapi.vkCreateSemaphore(vkapi.device, &sem_ci, NULL, &renderer->rendering_complete_sem);
-	if (result != VK_SUCCESS) {
-		fprintf(stderr, "vkCreateSemaphore failed: %i\n", result);
-		goto error;
-	}
-
 	return image_count;
 error:
-	if (renderer->image_acquired_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->image_acquired_sem, NULL);
-		renderer->image_acquired_sem = VK_NULL_HANDLE;
-	}
-	if (renderer->rendering_complete_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->rendering_complete_sem, NULL);
-		renderer->rendering_complete_sem = VK_NULL_HANDLE;
-	}
 	if (swapchain) vkapi.vkDestroySwapchainKHR(vkapi.device, swapchain, NULL);
 	if (renderer->swapchain) {
 		vkapi.vkDestroySwapchainKHR(vkapi.device, renderer->swapchain, NULL);
@@ -938,14 +2422,6 @@ error:
 
 static void destroy_swapchain(struct renderer * renderer) {
 
-	if (renderer->image_acquired_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->image_acquired_sem, NULL);
-		renderer->image_acquired_sem = VK_NULL_HANDLE;
-	}
-	if (renderer->rendering_complete_sem) {
-		vkapi.vkDestroySemaphore(vkapi.device, renderer->rendering_complete_sem, NULL);
-		renderer->rendering_complete_sem = VK_NULL_HANDLE;
-	}
 	if (renderer->swapchain) {
 		vkapi.vkDestroySwapchainKHR(vkapi.device, renderer->swapchain, NULL);
 		renderer->swapchain = VK_NULL_HANDLE;
@@ -957,6 +2433,109 @@ static void destroy_swapchain(struct renderer * renderer) {
 	}
 }
 
+static void destroy_offscreen_images(struct renderer * renderer) {
+
+	uint32_t i;
+	if (renderer->swapchain_images) {
+		for(i = 0; i < renderer->swapchain_image_count; i++) {
+			if (renderer->swapchain_images[i]) {
+				vkapi.vkDestroyImage(vkapi.device, renderer->swapchain_images[i], NULL);
+			}
+		}
+		free(renderer->swapchain_images);
+		renderer->swapchain_images = NULL;
+		renderer->swapchain_image_count = 0;
+	}
+	if (renderer->offscreen_memory) {
+		vkapi.vkFreeMemory(vkapi.device, renderer->offscreen_memory, NULL);
+		renderer->offscreen_memory = VK_NULL_HANDLE;
+	}
+}
+
+/* headless replacement for create_swapchain() */
+static uint32_t create_offscreen_images(struct renderer *renderer) {
+
+	VkResult result;
+	uint32_t i;
+	struct plat_surface * surface = renderer->surface;
+	uint32_t image_count = renderer->frame_lag > OFFSCREEN_IMAGES ? renderer->frame_lag : OFFSCREEN_IMAGES;
+
+	destroy_offscreen_images(renderer);
+
+	renderer->fb_extent.width = surface->width;
+	renderer->fb_extent.height = surface->height;
+	renderer->swapchain_images = calloc(image_count, sizeof(VkImage));
+	renderer->swapchain_image_count = image_count;
+	renderer->offscreen_next = 0;
+
+	struct VkImageCreateInfo image_ci = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = surface->s_format,
+		.extent = { .width = renderer->fb_extent.width, .height = renderer->fb_extent.height, .depth = 1 },
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	VkDeviceSize image_offsets[OFFSCREEN_IMAGES_MAX];
+	VkDeviceSize total_memory = 0;
+	uint32_t type_bits = UINT32_MAX;
+	for(i = 0; i < image_count; i++) {
+		result = vkapi.vkCreateImage(vkapi.device, &image_ci, NULL, &renderer->swapchain_images[i]);
+		if (result != VK_SUCCESS) {
+			fprintf(stderr, "vkCreateImage failed: %i\n", result);
+			goto error;
+		}
+		VkMemoryRequirements mem_req;
+		vkapi.vkGetImageMemoryRequirements(vkapi.device, renderer->swapchain_images[i], &mem_req);
+		if (total_memory % mem_req.alignment) {
+			total_memory += mem_req.alignment - (total_memory % mem_req.alignment);
+		}
+		image_offsets[i] = total_memory;
+		total_memory += mem_req.size;
+		type_bits &= mem_req.memoryTypeBits;
+	}
+	for (i = 0; i < vkapi.memory_properties.memoryTypeCount; i++) {
+		if ((type_bits & (1 << i))
+				&& (vkapi.memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+			break;
+		}
+	}
+	if (i == vkapi.memory_properties.memoryTypeCount) {
+		fprintf(stderr, "VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT memory not found!\n");
+		i = 0;
+	}
+	VkMemoryAllocateInfo mem_ai = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = total_memory,
+		.memoryTypeIndex = i,
+	};
+	result = vkapi.vkAllocateMemory(vkapi.device, &mem_ai, NULL, &renderer->offscreen_memory);
+	if (result != VK_SUCCESS) {
+		fprintf(stderr, "vkAllocateMemory failed: %i\n", result);
+		goto error;
+	}
+	for(i = 0; i < image_count; i++) {
+		result = vkapi.vkBindImageMemory(vkapi.device, renderer->swapchain_images[i],
+						renderer->offscreen_memory, image_offsets[i]);
+		if (result != VK_SUCCESS) {
+			fprintf(stderr, "vkBindImageMemory failed: %i\n", result);
+			goto error;
+		}
+	}
+
+	fprintf(stderr, "Created %u offscreen images\n", image_count);
+
+	return image_count;
+error:
+	destroy_offscreen_images(renderer);
+	return 0;
+}
+
 static void destroy_framebuffers(struct renderer * renderer) {
 
 	uint32_t i;
@@ -975,9 +2554,6 @@ static void destroy_framebuffers(struct renderer * renderer) {
 			if (framebuffers[i].view) {
 				vkapi.vkDestroyImageView(vkapi.device, framebuffers[i].view, NULL);
 			}
-			if (framebuffers[i].query_pool) {
-				vkapi.vkDestroyQueryPool(vkapi.device, framebuffers[i].query_pool, NULL);
-			}
 		}
 		free(framebuffers);
 	}
@@ -1037,17 +2613,6 @@ static struct framebuffer * create_framebuffers(struct renderer * renderer) {
 		.height = renderer->fb_extent.height,
 		.layers = 1,
 	};
-	VkQueryPoolCreateInfo qp_ci = {
-		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
-		.queryCount = 1,
-		.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
-				| VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
-				| VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
-				| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
-				| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
-				| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
-	};
 	VkDeviceSize depth_buf_offsets[renderer->swapchain_image_count];
 	VkDeviceSize total_memory = 0;
 	for(i = 0; i < renderer->swapchain_image_count; i++) {
@@ -1120,10 +2685,6 @@ static struct framebuffer * create_framebuffers(struct renderer * renderer) {
 		framebuffers[i].width = renderer->fb_extent.width;
 		framebuffers[i].height = renderer->fb_extent.height;
 		printf("framebuffers[%li] width: %llu\n", (long)i, (long long)framebuffers[i].width);
-		if (options.stats) {
-			result = vkapi.vkCreateQueryPool(vkapi.device, &qp_ci, NULL, &framebuffers[i].query_pool);
-			if (result != VK_SUCCESS) framebuffers[i].query_pool = VK_NULL_HANDLE;
-		}
 	}
 	renderer->fb_count = renderer->swapchain_image_count;
 	return framebuffers;
@@ -1132,23 +2693,151 @@ error:
 	return NULL;
 }
 
-void * render_loop(void * arg) {
+static void destroy_frames(struct renderer * renderer) {
 
-	struct renderer * renderer = (struct renderer *) arg;
+	uint32_t i;
+	for(i = 0; i < FRAME_LAG_MAX; i++) {
+		struct frame * frame = &renderer->frames[i];
+		if (frame->fence) {
+			vkapi.vkDestroyFence(vkapi.device, frame->fence, NULL);
+			frame->fence = VK_NULL_HANDLE;
+		}
+		if (frame->image_acquired_sem) {
+			vkapi.vkDestroySemaphore(vkapi.device, frame->image_acquired_sem, NULL);
+			frame->image_acquired_sem = VK_NULL_HANDLE;
+		}
+		if (frame->rendering_complete_sem) {
+			vkapi.vkDestroySemaphore(vkapi.device, frame->rendering_complete_sem, NULL);
+			frame->rendering_complete_sem = VK_NULL_HANDLE;
+		}
+		if (frame->query_pool) {
+			vkapi.vkDestroyQueryPool(vkapi.device, frame->query_pool, NULL);
+			frame->query_pool = VK_NULL_HANDLE;
+		}
+	}
+}
+
+/* Create the synchronization objects of the frames in flight.
+ * The command buffers and descriptor sets are allocated in create_pipeline().
+ */
+static VkResult create_frames(struct renderer * renderer) {
 
 	VkResult result;
-	uint32_t image_index, frame_index;
-	int i;
+	uint32_t i;
 
+	/* created signalled, so the first wait on each slot does not block */
 	VkFenceCreateInfo fence_ci = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+	};
+	const VkSemaphoreCreateInfo sem_ci = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	};
+	VkQueryPoolCreateInfo qp_ci = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = 1,
+		.pipelineStatistics = STATS_QUERY_FLAGS,
 	};
-	for(i = 0; i < FRAME_LAG; i++) {
-		result = vkapi.vkCreateFence(vkapi.device, &fence_ci, NULL, &renderer->frame_fences[i]);
+
+	for(i = 0; i < renderer->frame_lag; i++) {
+		struct frame * frame = &renderer->frames[i];
+		result = vkapi.vkCreateFence(vkapi.device, &fence_ci, NULL, &frame->fence);
 		if (result != VK_SUCCESS) {
 			fprintf(stderr, "vkCreateFence failed: %i\n", result);
-			goto finish;
+			goto error;
+		}
+		result = vkapi.vkCreateSemaphore(vkapi.device, &sem_ci, NULL, &frame->image_acquired_sem);
+		if (result != VK_SUCCESS) {
+			fprintf(stderr, "vkCreateSemaphore failed: %i\n", result);
+			goto error;
+		}
+		result = vkapi.vkCreateSemaphore(vkapi.device, &sem_ci, NULL, &frame->rendering_complete_sem);
+		if (result != VK_SUCCESS) {
+			fprintf(stderr, "vkCreateSemaphore failed: %i\n", result);
+			goto error;
+		}
+		if (options.stats) {
+			result = vkapi.vkCreateQueryPool(vkapi.device, &qp_ci, NULL, &frame->query_pool);
+			if (result != VK_SUCCESS) frame->query_pool = VK_NULL_HANDLE;
+		}
+	}
+	return VK_SUCCESS;
+error:
+	destroy_frames(renderer);
+	return result;
+}
+
+static void print_frame_stats(struct renderer * renderer, struct frame * frame) {
+
+	uint64_t data[6];
+
+	if (!frame->stats_pending) return;
+	frame->stats_pending = false;
+
+	if (renderer->gpu_cull) {
+		/* the counters are lost if the buffer has been replaced since */
+		if (frame->stats_buffer == renderer->buffer) {
+			const struct cull_header * header =
+				(const struct cull_header *)(renderer->mapped_memory + frame->cull_offset);
+			printf("GPU cull candidates:        %5u\n", frame->candidates_len);
+			printf("GPU culled:                 %5u\n", header->culled_count);
+			printf("GPU drawn:                  %5u\n", header->draw_count);
+		}
+	}
+	else {
+		printf("objects culled:             %5u of %u\n", frame->objects_culled, frame->objects_total);
+		printf("chunks culled:              %5u of %u\n", frame->chunks_culled, frame->chunks_total);
+		printf("draws:                      %5u\n", frame->draws_len);
+		printf("instances drawn:            %5u\n", frame->instances_drawn);
+	}
+	printf("instances written:          %5u\n", frame->instances_written);
+
+	if (!frame->query_pool) return;
+
+	VkResult result = vkapi.vkGetQueryPoolResults(vkapi.device, frame->query_pool, 0, 1,
+							sizeof(data), data, sizeof(data),
+							VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) return;
+	printf("input assembly vertices:    %5lli\n", (long long) data[0]);
+	printf("input assembly primitives:  %5lli\n", (long long) data[1]);
+	printf("vertex shader invocations:  %5lli\n", (long long) data[2]);
+	printf("clipping invocations:       %5lli\n", (long long) data[3]);
+	printf("clipping primitives:        %5lli\n", (long long) data[4]);
+	printf("fragment shader invocations:%5lli\n", (long long) data[5]);
+}
+
+/* Pass the present times reported since the last call to the frame pacer */
+static void record_present_timing(struct renderer * renderer, struct frame_pacer * pacer) {
+
+	VkPastPresentationTimingGOOGLE timings[8];
+	uint32_t i, count;
+
+	do {
+		count = 8;
+		VkResult result = vkapi.vkGetPastPresentationTimingGOOGLE(vkapi.device, renderer->swapchain,
+										&count, timings);
+		if (result != VK_SUCCESS && result != VK_INCOMPLETE) return;
+		for(i = 0; i < count; i++) {
+			frame_pacer_presented(pacer, timings[i].actualPresentTime / 1000000000.0);
 		}
+	} while (count == 8);
+}
+
+void * render_loop(void * arg) {
+
+	struct renderer * renderer = (struct renderer *) arg;
+
+	VkResult result;
+	uint32_t image_index, frame_index;
+
+	double start_time = timing_now();
+	bool first_frame = true;
+	struct frame_pacer * pacer = NULL;
+
+	result = create_frames(renderer);
+	if (result != VK_SUCCESS) {
+		goto finish;
 	}
 
 	result = render_init(renderer);
@@ -1158,22 +2847,21 @@ void * render_loop(void * arg) {
 
 	int frames = 0;
 
-	struct timeval last_tv, last_fps_tv, tv;
-	gettimeofday(&last_tv, NULL);
-	last_fps_tv = last_tv;
+	double now, last_fps_time = timing_now();
 
-	float fps_cap_frame_time;
+	/* for the --frames benchmark summary */
+	uint32_t total_frames = 0;
+	double first_frame_time = 0.0, prev_frame_time = 0.0;
+	float frame_time, frame_time_min = 0.0f, frame_time_max = 0.0f;
 
+	uint32_t present_id = 0;
 	if (options.fps_cap) {
-		fps_cap_frame_time = 1.0f / (float)options.fps_cap;
-	}
-	else {
-		fps_cap_frame_time = 0.0f;
+		pacer = frame_pacer_create(1.0 / options.fps_cap);
 	}
 
 	frame_index = 0;
 
-	create_pipeline(renderer);
+	if (!create_pipeline(renderer)) goto finish;
 
 	while(!exit_requested()) {
 		pthread_mutex_lock(&renderer->mutex);
@@ -1181,7 +2869,17 @@ void * render_loop(void * arg) {
 		pthread_mutex_unlock(&renderer->mutex);
 		if (stop) break;
 
-		if (!create_swapchain(renderer)) goto finish;
+		if (renderer->headless) {
+			if (!create_offscreen_images(renderer)) goto finish;
+		}
+		else {
+			if (!create_swapchain(renderer)) goto finish;
+			if (pacer && vkapi.display_timing) {
+				VkRefreshCycleDurationGOOGLE refresh;
+				result = vkapi.vkGetRefreshCycleDurationGOOGLE(vkapi.device, renderer->swapchain, &refresh);
+				if (result == VK_SUCCESS) frame_pacer_set_refresh(pacer, refresh.refreshDuration / 1000000000.0);
+			}
+		}
 
 		if (!create_framebuffers(renderer)) goto finish;
 
@@ -1191,108 +2889,128 @@ void * render_loop(void * arg) {
 			pthread_mutex_unlock(&renderer->mutex);
 			if (stop) break;
 
-			if (renderer->frame_fences_ready[frame_index]) {
-				// Ensure no more than FRAME_LAG presentations are outstanding
-				vkapi.vkWaitForFences(vkapi.device, 1, &renderer->frame_fences[frame_index], VK_TRUE, UINT64_MAX);
-				vkapi.vkResetFences(vkapi.device, 1, &renderer->frame_fences[frame_index]);
-			}
+			struct frame * frame = &renderer->frames[frame_index];
 
-			result = vkapi.vkAcquireNextImageKHR(vkapi.device,
-							     renderer->swapchain,
-							     50000000,
-							     renderer->image_acquired_sem,
-							     renderer->frame_fences[frame_index],
-							     &image_index);
-			renderer->frame_fences_ready[frame_index] = 1;
-			if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-				fprintf(stderr, "swapchain out of date, breaking\n");
-				break;
-			}
-			else if (result == VK_SUBOPTIMAL_KHR) {
-				fprintf(stderr, "swapchain suboptimal, continuing\n");
-			}
-			else if (result == VK_TIMEOUT) {
-				fprintf(stderr, "vkAcquireNextImageKHR timed out\n");
-			}
-			else if (result != VK_SUCCESS) {
-				fprintf(stderr, "vkAcquireNextImageKHR failed: %i\n", result);
-				goto finish;
-			}
-			render_scene(renderer, image_index);
-			VkPresentInfoKHR pi = {
-				.sType =  VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-				.swapchainCount = 1,
-				.pSwapchains = &renderer->swapchain,
-				.pImageIndices = &image_index,
-				.waitSemaphoreCount = 1,
-				.pWaitSemaphores = &renderer->rendering_complete_sem,
-			};
-			result = vkapi.vkQueuePresentKHR(vkapi.p_queue, &pi);
-			if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-				fprintf(stderr, "swapchain out of date\n");
-				break;
-			}
-			else if (result == VK_SUBOPTIMAL_KHR) {
-				fprintf(stderr, "swapchain suboptimal, breaking\n");
-				break;
-			}
-			else if (result != VK_SUCCESS) {
-				fprintf(stderr, "vkQueuePresentKHR failed: %i\n", result);
-				goto finish;
+			// Wait until the GPU is done with this slot's command buffer,
+			// uniforms and instance data; no more than frame_lag frames
+			// are in flight
+			vkapi.vkWaitForFences(vkapi.device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+			print_frame_stats(renderer, frame);
+
+			if (renderer->headless) {
+				image_index = renderer->offscreen_next;
+				renderer->offscreen_next = (image_index + 1) % renderer->swapchain_image_count;
+				if (!render_scene(renderer, frame, image_index)) goto finish;
 			}
-			VkQueryPool qp = renderer->framebuffers[image_index].query_pool;
-			if (qp) {
-				uint64_t data[6];
-				vkapi.vkGetQueryPoolResults(vkapi.device, qp, 0, 1, sizeof(data), data, sizeof(data),
-								VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-				printf("input assembly vertices:    %5lli\n", (long long) data[0]);
-				printf("input assembly primitives:  %5lli\n", (long long) data[1]);
-				printf("vertex shader invocations:  %5lli\n", (long long) data[2]);
-				printf("clipping invocations:       %5lli\n", (long long) data[3]);
-				printf("clipping primitives:        %5lli\n", (long long) data[4]);
-				printf("fragment shader invocations:%5lli\n", (long long) data[5]);
+			else {
+				result = vkapi.vkAcquireNextImageKHR(vkapi.device,
+								     renderer->swapchain,
+								     50000000,
+								     frame->image_acquired_sem,
+								     VK_NULL_HANDLE,
+								     &image_index);
+				if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+					fprintf(stderr, "swapchain out of date, breaking\n");
+					break;
+				}
+				else if (result == VK_SUBOPTIMAL_KHR) {
+					fprintf(stderr, "swapchain suboptimal, continuing\n");
+				}
+				else if (result == VK_TIMEOUT) {
+					fprintf(stderr, "vkAcquireNextImageKHR timed out\n");
+					continue;
+				}
+				else if (result != VK_SUCCESS) {
+					fprintf(stderr, "vkAcquireNextImageKHR failed: %i\n", result);
+					goto finish;
+				}
+				if (!render_scene(renderer, frame, image_index)) goto finish;
+				/* an id to match the past presentation timing with */
+				VkPresentTimeGOOGLE present_time = { .presentID = ++present_id };
+				VkPresentTimesInfoGOOGLE present_times_i = {
+					.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE,
+					.swapchainCount = 1,
+					.pTimes = &present_time,
+				};
+				VkPresentInfoKHR pi = {
+					.sType =  VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+					.pNext = (pacer && vkapi.display_timing) ? &present_times_i : NULL,
+					.swapchainCount = 1,
+					.pSwapchains = &renderer->swapchain,
+					.pImageIndices = &image_index,
+					.waitSemaphoreCount = 1,
+					.pWaitSemaphores = &frame->rendering_complete_sem,
+				};
+				result = vkapi.vkQueuePresentKHR(vkapi.p_queue, &pi);
+				if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+					fprintf(stderr, "swapchain out of date\n");
+					break;
+				}
+				else if (result == VK_SUBOPTIMAL_KHR) {
+					fprintf(stderr, "swapchain suboptimal, breaking\n");
+					break;
+				}
+				else if (result != VK_SUCCESS) {
+					fprintf(stderr, "vkQueuePresentKHR failed: %i\n", result);
+					goto finish;
+				}
+				if (pacer && vkapi.display_timing) record_present_timing(renderer, pacer);
 			}
 			frame_index += 1;
-			frame_index %= FRAME_LAG;
+			frame_index %= renderer->frame_lag;
 			frames++;
-			gettimeofday(&tv, NULL);
-			long seconds = tv.tv_sec - last_fps_tv.tv_sec;
-			if (seconds > 10 || (frames > 50 && seconds > 1)) {
-				float timedelta = tv.tv_sec - last_fps_tv.tv_sec;
-				timedelta += (float)((int32_t)tv.tv_usec - (int32_t)last_fps_tv.tv_usec) / 1000000.0;
-				printf("%5i frames in %5.2f s - %5.1f FPS\n", frames, timedelta, (float)frames / timedelta);
-				last_fps_tv = tv;
-				frames = 0;
+			now = timing_now();
+			if (first_frame) {
+				printf("time to first frame: %.2f ms (pipeline cache: %s)\n",
+						1000.0 * (now - start_time),
+						renderer->pipeline_cache_state);
+				first_frame = false;
 			}
-			if (fps_cap_frame_time) {
-				float timedelta = tv.tv_sec - last_tv.tv_sec;
-				timedelta += (float)((int32_t)tv.tv_usec - (int32_t)last_tv.tv_usec) / 1000000.0;
-				if (timedelta < fps_cap_frame_time) {
-					usleep((useconds_t)((fps_cap_frame_time - timedelta) * 1000000));
-					gettimeofday(&last_tv, NULL);
+			if (options.frames) {
+				if (total_frames == 0) {
+					first_frame_time = now;
 				}
 				else {
-					last_tv = tv;
+					frame_time = now - prev_frame_time;
+					if (total_frames == 1 || frame_time < frame_time_min) frame_time_min = frame_time;
+					if (frame_time > frame_time_max) frame_time_max = frame_time;
+				}
+				prev_frame_time = now;
+				if (++total_frames >= options.frames) {
+					float elapsed = now - first_frame_time;
+					printf("%u frames rendered, frame time: avg %.3f ms, min %.3f ms, max %.3f ms\n",
+							total_frames,
+							total_frames > 1 ? 1000.0f * elapsed / (total_frames - 1) : 0.0f,
+							1000.0f * frame_time_min, 1000.0f * frame_time_max);
+					request_exit();
 				}
 			}
+			float timedelta = now - last_fps_time;
+			if (timedelta > 10.0f || (frames > 50 && timedelta > 1.0f)) {
+				printf("%5i frames in %5.2f s - %5.1f FPS\n", frames, timedelta, (float)frames / timedelta);
+				if (pacer) frame_pacer_report(pacer);
+				last_fps_time = now;
+				frames = 0;
+			}
+			if (pacer) frame_pacer_wait(pacer);
 		}
 		vkapi.vkDeviceWaitIdle(vkapi.device);
 		destroy_framebuffers(renderer);
 	}
 finish:
 	fprintf(stderr, "render thread cleaning up...\n");
+	if (pacer) frame_pacer_destroy(pacer);
 	vkapi.vkDeviceWaitIdle(vkapi.device);
 	destroy_framebuffers(renderer);
-	destroy_swapchain(renderer);
+	if (renderer->headless) {
+		destroy_offscreen_images(renderer);
+	}
+	else {
+		destroy_swapchain(renderer);
+	}
 	destroy_pipeline(renderer);
 	render_deinit(renderer);
-	if (renderer->image_acquired_sem) vkapi.vkDestroySemaphore(vkapi.device, renderer->image_acquired_sem, NULL);
-	if (renderer->rendering_complete_sem) vkapi.vkDestroySemaphore(vkapi.device, renderer->rendering_complete_sem, NULL);
-	for(i = 0; i < FRAME_LAG; i++) {
-		if (renderer->frame_fences[i]) {
-			vkapi.vkDestroyFence(vkapi.device, renderer->frame_fences[i], NULL);
-		}
-	}
+	destroy_frames(renderer);
 	request_exit();
 	return NULL;
 }
@@ -1304,6 +3022,15 @@ struct renderer * start_renderer(struct plat_surface * surface, struct scene * s
 	renderer->surface = surface;
 	renderer->scene = scene;
 
+	renderer->frame_lag = options.frame_lag;
+	renderer->headless = (surface->vk_surface == VK_NULL_HANDLE);
+	if (renderer->headless) {
+		renderer->present_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	}
+	else {
+		renderer->present_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
+
 	pthread_mutex_init(&renderer->mutex, NULL);
 	pthread_create(&renderer->thread, NULL, render_loop, renderer);
 
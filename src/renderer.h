@@ -1,6 +1,12 @@
 #ifndef renderer_h
 #define renderer_h
 
+/* upper limit for the number of frames in flight (--frame-lag) */
+#define FRAME_LAG_MAX 8
+
+/* upper limit for the number of draw recording threads (--threads) */
+#define RECORD_THREADS_MAX 64
+
 struct scene;
 struct renderer * start_renderer(struct plat_surface * surface, struct scene * scene);
 void stop_renderer(struct renderer * renderer);
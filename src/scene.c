@@ -68,13 +68,17 @@ struct scene * create_scene(void) {
 	struct scene * scene = (struct scene *) calloc(1, sizeof(struct scene));
 	pthread_mutex_init(&scene->mutex, NULL);
 
-	scene->eye_pos.x =  0.0f;
-	scene->eye_pos.y =  0.0f;
-	scene->eye_pos.z = -5.0f;
-
-	scene->eye_dir.x =  0.0f;
-	scene->eye_dir.y =  0.0f;
-	scene->eye_dir.z =  1.0f;
+	struct scene_view view = {
+		.eye_pos = {  0.0f, 0.0f, -5.0f },
+		.eye_dir = {  0.0f, 0.0f,  1.0f },
+		.prev_eye_pos = {  0.0f, 0.0f, -5.0f },
+		.prev_eye_dir = {  0.0f, 0.0f,  1.0f },
+	};
+	scene->views[0] = scene->views[1] = scene->views[2] = view;
+	scene->view_last = view;
+	scene->view_back = 0;
+	scene->view_ready = 1;
+	scene->view_front = 2;
 
 	scene->ambient_light = AMBIENT_LIGHT;
 	scene->lights = LIGHTS;
@@ -82,60 +86,175 @@ struct scene * create_scene(void) {
 
 	scene->objects_size = 10;
 	scene->objects = (struct scene_object *)calloc(scene->objects_size, sizeof(struct scene_object));
+	scene->free_objects = (uint32_t *)calloc(scene->objects_size, sizeof(uint32_t));
 	scene->objects_len = 0;
 
+	scene->meshes_size = 4;
+	scene->meshes = (struct scene_mesh *)calloc(scene->meshes_size, sizeof(struct scene_mesh));
+	scene->meshes_len = 0;
+
 	scene->materials = MATERIALS;
 	scene->materials_len = MATERIAL_COUNT;
 
-	scene->s.view_dirty = 1;
 	scene->s.objects_dirty = 1;
 	scene->s.materials_dirty = 1;
 
 	return scene;
 }
 
-void scene_add_object(struct scene * scene, struct model * model, Mat4 matrix) {
+/* Find the model's mesh entry, or make a new one. Called with the scene locked. */
+static uint32_t scene_get_mesh(struct scene * scene, struct model * model) {
+
+	uint32_t i, free_mesh = UINT32_MAX;
+
+	for(i = 0; i < scene->meshes_len; i++) {
+		if (scene->meshes[i].model == model) return i;
+		if (!scene->meshes[i].model && free_mesh == UINT32_MAX) free_mesh = i;
+	}
+	if (free_mesh != UINT32_MAX) {
+		/* the renderer state is kept, it still holds the entry's buffer space */
+		i = free_mesh;
+	}
+	else {
+		if (scene->meshes_len == scene->meshes_size) {
+			uint32_t old_size = scene->meshes_size;
+			uint32_t added = scene->meshes_size / 2;
+			scene->meshes_size = old_size + added;
+			scene->meshes = realloc(scene->meshes, scene->meshes_size * sizeof(struct scene_mesh));
+			memset(scene->meshes + old_size, 0, added * sizeof(struct scene_mesh));
+		}
+		i = scene->meshes_len++;
+	}
+	scene->meshes[i].model = model;
+	scene->meshes[i].objects_len = 0;
+	scene->meshes[i].s.dirty = 1;
+	return i;
+}
+
+/* The scene takes ownership of the model, which may be shared by any number
+ * of objects and is destroyed with the last of them. Returns the object index,
+ * which stays valid until the object is removed.
+ */
+uint32_t scene_add_object(struct scene * scene, struct model * model, Mat4 matrix) {
+
+	uint32_t i;
 
 	scene_lock(scene);
-	if (scene->objects_len == scene->objects_size) {
-		uint32_t old_size = scene->objects_size;
-		uint32_t added = scene->objects_size / 2;
-		scene->objects_size = old_size + added;
-		scene->objects = realloc(scene->objects, scene->objects_size);
-		memset(scene->objects + old_size, 0, added * sizeof(struct scene_object));
+	if (scene->free_objects_len) {
+		/* the renderer state is kept, it still holds the slot's buffer space */
+		i = scene->free_objects[--scene->free_objects_len];
+	}
+	else {
+		if (scene->objects_len == scene->objects_size) {
+			uint32_t old_size = scene->objects_size;
+			uint32_t added = scene->objects_size / 2;
+			scene->objects_size = old_size + added;
+			scene->objects = realloc(scene->objects, scene->objects_size * sizeof(struct scene_object));
+			scene->free_objects = realloc(scene->free_objects, scene->objects_size * sizeof(uint32_t));
+			memset(scene->objects + old_size, 0, added * sizeof(struct scene_object));
+		}
+		i = scene->objects_len++;
 	}
-	uint32_t i = scene->objects_len++;
 	struct scene_object * obj = &scene->objects[i];
 
 	obj->model_matrix = matrix;
+	obj->matrix_class = mat4_classify(matrix);
 	obj->model = model;
+	obj->mesh = scene_get_mesh(scene, model);
+	scene->meshes[obj->mesh].objects_len++;
 
 	obj->s.matrix_dirty = 1;
-	obj->s.mesh_dirty = 1;
 
 	scene->s.objects_dirty = 1;
 	scene_unlock(scene);
+	return i;
+}
+
+/* Remove the object, and destroy its model when no other object uses it.
+ * The slot may be reused.
+ */
+void scene_remove_object(struct scene * scene, uint32_t index) {
+
+	scene_lock(scene);
+	assert(index < scene->objects_len && scene->objects[index].model);
+	scene->free_objects[scene->free_objects_len++] = index;
+	struct scene_mesh * mesh = &scene->meshes[scene->objects[index].mesh];
+	if (--mesh->objects_len == 0) {
+		destroy_model(mesh->model);
+		mesh->model = NULL;
+	}
+	scene->objects[index].model = NULL;
+	scene->s.objects_dirty = 1;
+	scene_unlock(scene);
+}
+
+void scene_set_object_matrix(struct scene * scene, uint32_t index, Mat4 matrix) {
+
+	scene_lock(scene);
+	assert(index < scene->objects_len && scene->objects[index].model);
+	struct scene_object * obj = &scene->objects[index];
+	obj->model_matrix = matrix;
+	obj->matrix_class = mat4_classify(matrix);
+	obj->s.matrix_dirty = 1;
+	scene_unlock(scene);
 }
 
-void scene_set_eye(struct scene * scene, Vec3 position, Vec3 direction) {
+/* the object's model data was modified, upload it again,
+ * for all the objects sharing the model */
+void scene_object_mesh_changed(struct scene * scene, uint32_t index) {
 
 	scene_lock(scene);
-	scene->eye_pos = position;
-	scene->eye_dir = direction;
+	assert(index < scene->objects_len && scene->objects[index].model);
+	scene->meshes[scene->objects[index].mesh].s.dirty = 1;
 	scene_unlock(scene);
 }
 
+/* Publish the view at 'time' for the next frames, along with the one
+ * published before. Called by a single writer, the world thread,
+ * does not lock the scene.
+ */
+void scene_set_eye(struct scene * scene, Vec3 position, Vec3 direction, double time) {
+
+	struct scene_view * view = &scene->views[scene->view_back];
+	view->prev_eye_pos = scene->view_last.eye_pos;
+	view->prev_eye_dir = scene->view_last.eye_dir;
+	view->prev_time = scene->view_last.time;
+	view->eye_pos = position;
+	view->eye_dir = direction;
+	view->time = time;
+	scene->view_last = *view;
+
+	/* release the view, acquire the slot the reader has let go of */
+	uint32_t prev = __atomic_exchange_n(&scene->view_ready, scene->view_back | SCENE_VIEW_FRESH,
+						__ATOMIC_ACQ_REL);
+	scene->view_back = prev & ~SCENE_VIEW_FRESH;
+}
+
+/* The newest view published, valid until the next call. Called by a single
+ * reader, the render thread, does not lock the scene.
+ */
+const struct scene_view * scene_get_view(struct scene * scene) {
+
+	if (__atomic_load_n(&scene->view_ready, __ATOMIC_RELAXED) & SCENE_VIEW_FRESH) {
+		uint32_t prev = __atomic_exchange_n(&scene->view_ready, scene->view_front, __ATOMIC_ACQ_REL);
+		scene->view_front = prev & ~SCENE_VIEW_FRESH;
+	}
+	return &scene->views[scene->view_front];
+}
+
 void destroy_scene(struct scene * scene) {
 
 	uint32_t i;
 
 	if (!scene) return;
-	if (scene->objects) {
-		for(i = 0; i < scene->objects_len; i++) {
-			destroy_model(scene->objects[i].model);
+	if (scene->meshes) {
+		for(i = 0; i < scene->meshes_len; i++) {
+			if (scene->meshes[i].model) destroy_model(scene->meshes[i].model);
 		}
-		free(scene->objects);
+		free(scene->meshes);
 	}
+	free(scene->objects);
+	free(scene->free_objects);
 	free(scene);
 }
 
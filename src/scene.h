@@ -20,26 +20,70 @@ struct light {
 	Vec4 specular;
 };
 
+/* a model, uploaded once and drawn by all the objects using it */
+struct scene_mesh {
+	struct model * model; /* NULL when no object uses it */
+	uint32_t objects_len; /* objects using the model */
+
+	/* scene state - set by scene, cleared by renderer */
+	struct {
+		int dirty; /* new or changed model data */
+	} s;
+
+	/* renderer state - mainained by renderer */
+	struct {
+		uint32_t vertex_index;
+		uint32_t index_index;
+		uint32_t vertices_len, indices_len; /* space taken in the mesh buffer */
+		/* packed vertex positions to model coordinates */
+		Vec3 pos_offset, pos_scale;
+		/* the visible objects' range of the frame's instance list */
+		uint32_t instances_start, instances_len;
+	} r;
+};
+
 struct scene_object {
-	struct model * model;
+	struct model * model; /* NULL when removed */
+	uint32_t mesh; /* the model's entry in scene->meshes */
 	Mat4 model_matrix;
+	enum mat4_class matrix_class; /* mat4_classify(model_matrix) */
 
 	/* scene state - set by scene, cleared by renderer */
 	struct {
 		int matrix_dirty;
-		int mesh_dirty;
 	} s;
 
 	/* renderer state - mainained by renderer */
 	struct {
-		uint32_t vertex_index;
 		uint32_t instance_index;
-		uint32_t index_index;
+		int has_instance; /* instance_index is allocated */
+		uint32_t frames_valid; /* frame slots holding current instance data, bit per slot */
+		int visible; /* passed frustum culling in the last render_scene() */
 	} r;
 };
 
-struct scene {
+/* per-tick state published by the world thread, see scene_set_eye(),
+ * with the previous tick's to interpolate between */
+struct scene_view {
 	Vec3 eye_pos, eye_dir;
+	double time; /* of the tick, in seconds */
+	Vec3 prev_eye_pos, prev_eye_dir;
+	double prev_time;
+};
+
+/* set in scene->view_ready when the slot holds a view not taken yet */
+#define SCENE_VIEW_FRESH 4u
+
+struct scene {
+	/* triple buffered view, handed from the world thread to the render thread
+	 * without locking: the writer fills views[view_back] and swaps it with
+	 * view_ready, the reader swaps its views[view_front] with view_ready when
+	 * that is fresh. Neither ever waits for the other. */
+	struct scene_view views[3];
+	uint32_t view_back;  /* owned by the writer */
+	uint32_t view_ready; /* slot index | SCENE_VIEW_FRESH, accessed atomically */
+	uint32_t view_front; /* owned by the reader */
+	struct scene_view view_last; /* the last one published, owned by the writer */
 
 	Vec4 ambient_light;
 	const struct light * lights;
@@ -48,14 +92,21 @@ struct scene {
 	struct scene_object * objects;
 	uint32_t objects_len;
 	uint32_t objects_size;
+	/* removed objects' slots, reused by scene_add_object(), objects_size long */
+	uint32_t * free_objects;
+	uint32_t free_objects_len;
+
+	/* distinct models of the objects, unused entries have a NULL model */
+	struct scene_mesh * meshes;
+	uint32_t meshes_len;
+	uint32_t meshes_size;
 
 	const struct material * materials;
 	uint32_t materials_len;
 
 	/* scene state – set by scene, cleared by renderer */
 	struct {
-		int view_dirty;    /* eye position or direction changed */
-		int objects_dirty; /* object list changed - rebuild everything */
+		int objects_dirty; /* objects added or removed */
 		int materials_dirty; /* materials changed */
 	} s;
 
@@ -74,8 +125,12 @@ struct scene * create_scene(void);
 #define scene_lock(scene)   pthread_mutex_lock(&(scene)->mutex)
 #define scene_unlock(scene) pthread_mutex_unlock(&(scene)->mutex)
 
-void scene_add_object(struct scene * scene, struct model * model, Mat4 matrix);
-void scene_set_eye(struct scene * scene, Vec3 position, Vec3 direction);
+uint32_t scene_add_object(struct scene * scene, struct model * model, Mat4 matrix);
+void scene_remove_object(struct scene * scene, uint32_t index);
+void scene_set_object_matrix(struct scene * scene, uint32_t index, Mat4 matrix);
+void scene_object_mesh_changed(struct scene * scene, uint32_t index);
+void scene_set_eye(struct scene * scene, Vec3 position, Vec3 direction, double time);
+const struct scene_view * scene_get_view(struct scene * scene);
 void destroy_scene(struct scene * scene);
 
 #endif
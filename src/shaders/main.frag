@@ -1,6 +1,7 @@
 #version 420 core
 
 const uint V_FLAG_FLAT = 1;
+const uint V_FLAG_FACETED = 2;
 
 struct material_s {
 	vec4 ambient_color;
@@ -45,19 +46,25 @@ void main() {
 	}
 	else {
 		material_s material = ubuf.materials[v_material];
+		vec3 n = N;
+		if ((v_flags & V_FLAG_FACETED) == V_FLAG_FACETED) {
+			// vertices are shared between faces, use the face normal
+			n = normalize(cross(dFdx(V), dFdy(V)));
+			if (dot(n, V) > 0.0) n = -n;
+		}
 		f_color = v_ambient_color;
 		for(int i = 0; i < lights_len; i++) {
 			light_s light = ubuf.lights[i];
 
 			vec3 L = normalize(vec3(ubuf.v_matrix * light.position) - V);
 
-			float nl = dot(N, L);
+			float nl = dot(n, L);
 			vec4 diffuse = light.diffuse * material.diffuse_color * max(nl, 0.0);
 			diffuse = clamp(diffuse, 0.0, 1.0);
 			f_color += diffuse;
 
 			if (nl >= 0.0) {
-				vec3 R = normalize(-reflect(L, N));
+				vec3 R = normalize(-reflect(L, n));
 				float re = dot(R, normalize(-V));
 				vec4 specular = light.specular * material.specular_color * pow(max(re, 0.0), material.shininess);
 				specular = clamp(specular, 0.0, 1.0);
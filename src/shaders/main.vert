@@ -1,6 +1,7 @@
-#version 420 core
+#version 450 core
 
 const uint V_FLAG_FLAT = 1;
+const uint V_FLAG_FACETED = 2;
 
 struct material_s {
 	vec4 ambient_color;
@@ -28,16 +29,24 @@ layout(std140, binding = 0) uniform buf {
 	light_s lights[lights_len];
 } ubuf;
 
-/* vertex data */
+/* vertex data (packed, see struct packed_vertex) */
 layout(location = 0) in vec4 in_position;
-layout(location = 1) in vec4 in_normal;
-layout(location = 2) in uint in_material;
-layout(location = 3) in uint in_flags;
+layout(location = 1) in vec2 in_normal;
+layout(location = 2) in uint in_material_flags;
+
+/* instance data, by the object instance index */
+struct instance_s {
+	mat4 mv_matrix;
+	mat4 mvp_matrix;
+	mat4 normal_matrix;
+};
+
+layout(std430, binding = 1) readonly buffer instance_buf {
+	instance_s instances[];
+};
 
-/* instance data */
-layout(location = 4) in mat4 mv_matrix;
-layout(location = 8) in mat4 mvp_matrix;
-layout(location = 12) in mat4 normal_matrix;
+/* the instance list entry, index into instances[] */
+layout(location = 4) in uint in_instance;
 
 layout(location = 0) out vec3 V;
 layout(location = 1) out vec3 N;
@@ -51,19 +60,34 @@ out gl_PerVertex {
   vec4 gl_Position;
 };
 
+/* octahedral normal decoding */
+vec3 oct_decode(vec2 e) {
+
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
 
 void main() {
 
+	uint material_idx = in_material_flags & 0xffff;
+	vec4 normal = vec4(oct_decode(in_normal), 0.0);
+	mat4 mv_matrix = instances[in_instance].mv_matrix;
+	mat4 mvp_matrix = instances[in_instance].mvp_matrix;
+	mat4 normal_matrix = instances[in_instance].normal_matrix;
+
 	gl_Position = mvp_matrix * in_position;
 
 	V = vec3(mv_matrix * in_position);
-	N = normalize(vec3(normal_matrix * in_normal));
+	N = normalize(vec3(normal_matrix * normal));
 	v_mv_matrix = mv_matrix;
 
-	v_flags = in_flags;
-	v_material = in_material;
+	v_flags = in_material_flags >> 16;
+	v_material = material_idx;
 
-	material_s material = ubuf.materials[in_material];
+	material_s material = ubuf.materials[material_idx];
 
 	vec4 ambient = ubuf.ambient_light * material.ambient_color;
 	ambient = clamp(ambient, 0.0, 1.0);
@@ -7,7 +7,7 @@ struct plat_surface {
 	void (*event_loop)(struct plat_surface *surf);
 	void (*destroy)(struct plat_surface *surf);
 
-	// Vulkan surface object
+	// Vulkan surface object, VK_NULL_HANDLE for headless (offscreen) rendering
 	VkSurfaceKHR vk_surface;
 
 	// Vulkan surface capabilities
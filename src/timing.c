@@ -0,0 +1,32 @@
+#include <errno.h>
+
+#include "timing.h"
+
+double timing_now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+struct timespec timing_timespec(double time) {
+
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)time;
+	ts.tv_nsec = (long)((time - (double)ts.tv_sec) * 1000000000.0);
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+void timing_sleep_until(double deadline) {
+
+	struct timespec ts = timing_timespec(deadline);
+
+	/* an absolute deadline, restarting after a signal does not add any delay */
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
@@ -0,0 +1,20 @@
+#ifndef timing_h
+#define timing_h
+
+#include <time.h>
+
+/* Time keeping on CLOCK_MONOTONIC, which wall-clock adjustments (NTP, the
+ * user setting the date) do not make jump. The timestamps of all the threads
+ * are on this clock, so they can be compared and interpolated between.
+ */
+
+/* current time, in seconds */
+double timing_now(void);
+
+/* 'time' as a timespec, for the absolute CLOCK_MONOTONIC waits */
+struct timespec timing_timespec(double time);
+
+/* sleep until 'deadline' (timing_now() seconds), at once when already past */
+void timing_sleep_until(double deadline);
+
+#endif
@@ -75,6 +75,7 @@ int vkapi_init_instance(const char * app_name) {
 	GET_INST_PROC(vkCreateDevice);
 	GET_INST_PROC(vkDestroyInstance);
 	GET_INST_PROC(vkDestroySurfaceKHR);
+	GET_INST_PROC(vkEnumerateDeviceExtensionProperties);
 	GET_INST_PROC(vkEnumeratePhysicalDevices);
 	GET_INST_PROC(vkGetPhysicalDeviceFeatures);
 	GET_INST_PROC(vkGetPhysicalDeviceMemoryProperties);
@@ -98,9 +99,8 @@ error:
 	return VK_ERROR_INITIALIZATION_FAILED;
 }
 
-static int _vkapi_init_device_procs(void) {
+static int _vkapi_init_device_procs(int swapchain) {
 
-	GET_DEV_PROC(vkAcquireNextImageKHR);
 	GET_DEV_PROC(vkAllocateCommandBuffers);
 	GET_DEV_PROC(vkAllocateDescriptorSets);
 	GET_DEV_PROC(vkAllocateMemory);
@@ -112,15 +112,21 @@ static int _vkapi_init_device_procs(void) {
 	GET_DEV_PROC(vkCmdBindIndexBuffer);
 	GET_DEV_PROC(vkCmdBindPipeline);
 	GET_DEV_PROC(vkCmdBindVertexBuffers);
+	GET_DEV_PROC(vkCmdCopyBuffer);
+	GET_DEV_PROC(vkCmdDispatch);
+	GET_DEV_PROC(vkCmdExecuteCommands);
 	GET_DEV_PROC(vkCmdDraw);
 	GET_DEV_PROC(vkCmdDrawIndexed);
+	GET_DEV_PROC(vkCmdDrawIndexedIndirect);
 	GET_DEV_PROC(vkCmdEndRenderPass);
 	GET_DEV_PROC(vkCmdPipelineBarrier);
+	GET_DEV_PROC(vkCmdPushConstants);
 	GET_DEV_PROC(vkCmdResetQueryPool);
 	GET_DEV_PROC(vkCmdSetScissor);
 	GET_DEV_PROC(vkCmdSetViewport);
 	GET_DEV_PROC(vkCreateBuffer);
 	GET_DEV_PROC(vkCreateCommandPool);
+	GET_DEV_PROC(vkCreateComputePipelines);
 	GET_DEV_PROC(vkCreateDescriptorPool);
 	GET_DEV_PROC(vkCreateDescriptorSetLayout);
 	GET_DEV_PROC(vkCreateFence);
@@ -128,12 +134,12 @@ static int _vkapi_init_device_procs(void) {
 	GET_DEV_PROC(vkCreateGraphicsPipelines);
 	GET_DEV_PROC(vkCreateImage);
 	GET_DEV_PROC(vkCreateImageView);
+	GET_DEV_PROC(vkCreatePipelineCache);
 	GET_DEV_PROC(vkCreatePipelineLayout);
 	GET_DEV_PROC(vkCreateQueryPool);
 	GET_DEV_PROC(vkCreateRenderPass);
 	GET_DEV_PROC(vkCreateSemaphore);
 	GET_DEV_PROC(vkCreateShaderModule);
-	GET_DEV_PROC(vkCreateSwapchainKHR);
 	GET_DEV_PROC(vkDestroyBuffer);
 	GET_DEV_PROC(vkDestroyCommandPool);
 	GET_DEV_PROC(vkDestroyDescriptorPool);
@@ -144,23 +150,23 @@ static int _vkapi_init_device_procs(void) {
 	GET_DEV_PROC(vkDestroyImage);
 	GET_DEV_PROC(vkDestroyImageView);
 	GET_DEV_PROC(vkDestroyPipeline);
+	GET_DEV_PROC(vkDestroyPipelineCache);
 	GET_DEV_PROC(vkDestroyPipelineLayout);
 	GET_DEV_PROC(vkDestroyQueryPool);
 	GET_DEV_PROC(vkDestroyRenderPass);
 	GET_DEV_PROC(vkDestroySemaphore);
 	GET_DEV_PROC(vkDestroyShaderModule);
-	GET_DEV_PROC(vkDestroySwapchainKHR);
 	GET_DEV_PROC(vkDeviceWaitIdle);
 	GET_DEV_PROC(vkEndCommandBuffer);
+	GET_DEV_PROC(vkFreeCommandBuffers);
 	GET_DEV_PROC(vkFreeDescriptorSets);
 	GET_DEV_PROC(vkFreeMemory);
 	GET_DEV_PROC(vkGetBufferMemoryRequirements);
 	GET_DEV_PROC(vkGetDeviceQueue);
 	GET_DEV_PROC(vkGetImageMemoryRequirements);
+	GET_DEV_PROC(vkGetPipelineCacheData);
 	GET_DEV_PROC(vkGetQueryPoolResults);
-	GET_DEV_PROC(vkGetSwapchainImagesKHR);
 	GET_DEV_PROC(vkMapMemory);
-	GET_DEV_PROC(vkQueuePresentKHR);
 	GET_DEV_PROC(vkQueueSubmit);
 	GET_DEV_PROC(vkResetCommandBuffer);
 	GET_DEV_PROC(vkResetCommandPool);
@@ -170,11 +176,28 @@ static int _vkapi_init_device_procs(void) {
 	GET_DEV_PROC(vkUpdateDescriptorSets);
 	GET_DEV_PROC(vkWaitForFences);
 
+	if (swapchain) {
+		GET_DEV_PROC(vkAcquireNextImageKHR);
+		GET_DEV_PROC(vkCreateSwapchainKHR);
+		GET_DEV_PROC(vkDestroySwapchainKHR);
+		GET_DEV_PROC(vkGetSwapchainImagesKHR);
+		GET_DEV_PROC(vkQueuePresentKHR);
+	}
+
 	if (options.stats) {
 		GET_DEV_PROC(vkCmdBeginQuery);
 		GET_DEV_PROC(vkCmdEndQuery);
 	}
 
+	if (vkapi.draw_indirect_count) {
+		GET_DEV_PROC(vkCmdDrawIndexedIndirectCountKHR);
+	}
+
+	if (vkapi.display_timing) {
+		GET_DEV_PROC(vkGetPastPresentationTimingGOOGLE);
+		GET_DEV_PROC(vkGetRefreshCycleDurationGOOGLE);
+	}
+
 	return VK_SUCCESS;
 error:
 	return VK_ERROR_INITIALIZATION_FAILED;
@@ -283,7 +306,12 @@ int vkapi_init_device(struct plat_surface * surface) {
 	}
 	vkapi.vkGetPhysicalDeviceMemoryProperties(vkapi.physical_devices[selected_dev], &vkapi.memory_properties);
 
-	vkapi.g_queue_family = selected_p_qf;
+	if (!vk_surface) {
+		/* headless – nothing will be presented */
+		selected_p_qf = selected_g_qf;
+	}
+
+	vkapi.g_queue_family = selected_g_qf;
 	vkapi.p_queue_family = selected_p_qf;
 
 	float q_priority = 0.0;
@@ -302,11 +330,45 @@ int vkapi_init_device(struct plat_surface * surface) {
 		}
 	};
 
-	/* require no optional features */
-	VkPhysicalDeviceFeatures features = {0};
+	/* require no optional features, enable the ones the renderer can use */
+	VkPhysicalDeviceFeatures features = {
+		.multiDrawIndirect = vkapi.device_features.multiDrawIndirect,
+		.drawIndirectFirstInstance = vkapi.device_features.drawIndirectFirstInstance,
+		.pipelineStatisticsQuery = options.stats,
+		/* the --stats query stays active while the --threads secondary buffers execute */
+		.inheritedQueries = options.stats && vkapi.device_features.inheritedQueries,
+	};
+
+	const char * extensions[4];
+	uint32_t ext_count = 0;
+	if (vk_surface) {
+		/* no swapchain needed for offscreen rendering */
+		for(i = 0; device_extensions[i]; i++) extensions[ext_count++] = device_extensions[i];
+	}
 
-	uint32_t ext_count;
-	for(ext_count=0; device_extensions[ext_count]; ext_count++);
+	/* optional: GPU culling can fall back to fixed-size indirect draws,
+	 * the frame pacer to the CPU clock */
+	vkapi.draw_indirect_count = false;
+	vkapi.display_timing = false;
+	if (options.gpu_cull || (vk_surface && options.fps_cap)) {
+		uint32_t dev_ext_count = 0;
+		vkapi.vkEnumerateDeviceExtensionProperties(vkapi.physical_devices[selected_dev], NULL, &dev_ext_count, NULL);
+		VkExtensionProperties * dev_exts = calloc(dev_ext_count, sizeof(VkExtensionProperties));
+		vkapi.vkEnumerateDeviceExtensionProperties(vkapi.physical_devices[selected_dev], NULL, &dev_ext_count, dev_exts);
+		for(i = 0; i < dev_ext_count; i++) {
+			if (options.gpu_cull
+					&& !strcmp(dev_exts[i].extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+				extensions[ext_count++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+				vkapi.draw_indirect_count = true;
+			}
+			else if (vk_surface && options.fps_cap
+					&& !strcmp(dev_exts[i].extensionName, VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME)) {
+				extensions[ext_count++] = VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME;
+				vkapi.display_timing = true;
+			}
+		}
+		free(dev_exts);
+	}
 
 	struct VkDeviceCreateInfo dev_ci = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
@@ -314,7 +376,7 @@ int vkapi_init_device(struct plat_surface * surface) {
 		.pQueueCreateInfos = queue_ci,
 		.pEnabledFeatures = &features,
 		.enabledExtensionCount=ext_count,
-		.ppEnabledExtensionNames=device_extensions,
+		.ppEnabledExtensionNames=extensions,
 	};
 
 	result = vkapi.vkCreateDevice(vkapi.physical_devices[selected_dev], &dev_ci, NULL, &vkapi.device);
@@ -325,7 +387,7 @@ int vkapi_init_device(struct plat_surface * surface) {
 	}
 
 	vkapi.selected_device = selected_dev;
-	result = _vkapi_init_device_procs();
+	result = _vkapi_init_device_procs(vk_surface != VK_NULL_HANDLE);
 	if (result != VK_SUCCESS) goto error;
 
 	vkapi.vkGetDeviceQueue(vkapi.device, selected_g_qf, 0, &vkapi.g_queue);
@@ -341,6 +403,13 @@ int vkapi_init_device(struct plat_surface * surface) {
 
 	vkapi.physical_device = vkapi.physical_devices[vkapi.selected_device];
 
+	if (!vk_surface) {
+		printf("Headless rendering, using VK_FORMAT_B8G8R8A8_SRGB\n");
+		surface->s_format = VK_FORMAT_B8G8R8A8_SRGB;
+		surface->s_colorspace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+		return VK_SUCCESS;
+	}
+
 	result = vkapi.vkGetPhysicalDeviceSurfaceFormatsKHR(vkapi.physical_device, vk_surface, &surface->s_formats_count, NULL);
 	if (result != VK_SUCCESS) {
 		fprintf(stderr, "vkGetPhysicalDeviceSurfaceFormatsKHR failed: %i\n", result);
@@ -404,6 +473,18 @@ void vkapi_finish_device(void) {
 	vkapi.p_queue = VK_NULL_HANDLE;
 }
 
+uint32_t vkapi_find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags) {
+
+	uint32_t i;
+	for (i = 0; i < vkapi.memory_properties.memoryTypeCount; i++) {
+		if (!(type_bits & (1 << i))) continue;
+		if ((vkapi.memory_properties.memoryTypes[i].propertyFlags & flags) == flags) {
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
 void vkapi_finish(void) {
 
 	if (vkapi.device) vkapi_finish_device();
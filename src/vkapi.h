@@ -9,6 +9,7 @@
 #endif
 
 #include <vulkan/vulkan.h>
+#include <stdbool.h>
 
 #define DEF_INST_PROC(x) PFN_##x x
 #define DEF_DEV_PROC(x) PFN_##x x
@@ -22,6 +23,8 @@ struct vkapi {
 	VkPhysicalDeviceProperties device_properties;
 	VkPhysicalDeviceFeatures device_features;
 	VkPhysicalDeviceMemoryProperties memory_properties;
+	bool draw_indirect_count; /* VK_KHR_draw_indirect_count enabled */
+	bool display_timing; /* VK_GOOGLE_display_timing enabled */
 
 	uint32_t g_queue_family;
 	VkQueue g_queue;
@@ -32,6 +35,7 @@ struct vkapi {
 	DEF_INST_PROC(vkCreateInstance);
 	DEF_INST_PROC(vkDestroyInstance);
 	DEF_INST_PROC(vkDestroySurfaceKHR);
+	DEF_INST_PROC(vkEnumerateDeviceExtensionProperties);
 	DEF_INST_PROC(vkEnumerateInstanceExtensionProperties);
 	DEF_INST_PROC(vkEnumerateInstanceLayerProperties);
 	DEF_INST_PROC(vkEnumeratePhysicalDevices);
@@ -57,16 +61,23 @@ struct vkapi {
 	DEF_DEV_PROC(vkCmdBindIndexBuffer);
 	DEF_DEV_PROC(vkCmdBindPipeline);
 	DEF_DEV_PROC(vkCmdBindVertexBuffers);
+	DEF_DEV_PROC(vkCmdCopyBuffer);
+	DEF_DEV_PROC(vkCmdDispatch);
+	DEF_DEV_PROC(vkCmdExecuteCommands);
 	DEF_DEV_PROC(vkCmdDraw);
 	DEF_DEV_PROC(vkCmdDrawIndexed);
+	DEF_DEV_PROC(vkCmdDrawIndexedIndirect);
+	DEF_DEV_PROC(vkCmdDrawIndexedIndirectCountKHR);
 	DEF_DEV_PROC(vkCmdEndQuery);
 	DEF_DEV_PROC(vkCmdEndRenderPass);
 	DEF_DEV_PROC(vkCmdPipelineBarrier);
+	DEF_DEV_PROC(vkCmdPushConstants);
 	DEF_DEV_PROC(vkCmdResetQueryPool);
 	DEF_DEV_PROC(vkCmdSetScissor);
 	DEF_DEV_PROC(vkCmdSetViewport);
 	DEF_DEV_PROC(vkCreateBuffer);
 	DEF_DEV_PROC(vkCreateCommandPool);
+	DEF_DEV_PROC(vkCreateComputePipelines);
 	DEF_DEV_PROC(vkCreateDescriptorPool);
 	DEF_DEV_PROC(vkCreateDescriptorSetLayout);
 	DEF_DEV_PROC(vkCreateFence);
@@ -74,6 +85,7 @@ struct vkapi {
 	DEF_DEV_PROC(vkCreateGraphicsPipelines);
 	DEF_DEV_PROC(vkCreateImage);
 	DEF_DEV_PROC(vkCreateImageView);
+	DEF_DEV_PROC(vkCreatePipelineCache);
 	DEF_DEV_PROC(vkCreatePipelineLayout);
 	DEF_DEV_PROC(vkCreateQueryPool);
 	DEF_DEV_PROC(vkCreateRenderPass);
@@ -90,6 +102,7 @@ struct vkapi {
 	DEF_DEV_PROC(vkDestroyImage);
 	DEF_DEV_PROC(vkDestroyImageView);
 	DEF_DEV_PROC(vkDestroyPipeline);
+	DEF_DEV_PROC(vkDestroyPipelineCache);
 	DEF_DEV_PROC(vkDestroyPipelineLayout);
 	DEF_DEV_PROC(vkDestroyQueryPool);
 	DEF_DEV_PROC(vkDestroyRenderPass);
@@ -98,12 +111,16 @@ struct vkapi {
 	DEF_DEV_PROC(vkDestroySwapchainKHR);
 	DEF_DEV_PROC(vkDeviceWaitIdle);
 	DEF_DEV_PROC(vkEndCommandBuffer);
+	DEF_DEV_PROC(vkFreeCommandBuffers);
 	DEF_DEV_PROC(vkFreeDescriptorSets);
 	DEF_DEV_PROC(vkFreeMemory);
 	DEF_DEV_PROC(vkGetBufferMemoryRequirements);
 	DEF_DEV_PROC(vkGetDeviceQueue);
 	DEF_DEV_PROC(vkGetImageMemoryRequirements);
+	DEF_DEV_PROC(vkGetPastPresentationTimingGOOGLE);
+	DEF_DEV_PROC(vkGetPipelineCacheData);
 	DEF_DEV_PROC(vkGetQueryPoolResults);
+	DEF_DEV_PROC(vkGetRefreshCycleDurationGOOGLE);
 	DEF_DEV_PROC(vkGetSwapchainImagesKHR);
 	DEF_DEV_PROC(vkMapMemory);
 	DEF_DEV_PROC(vkQueuePresentKHR);
@@ -140,4 +157,8 @@ void vkapi_finish_device(void);
 /* destroy the remaining Vulkan API objects */
 void vkapi_finish(void);
 
+/* find a memory type allowed by type_bits and having all the flags
+ * returns UINT32_MAX if there is none */
+uint32_t vkapi_find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags);
+
 #endif
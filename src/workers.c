@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "workers.h"
+
+struct worker_pool {
+	pthread_t * threads;
+	uint32_t size;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond; /* a new job, or stop */
+	pthread_cond_t done_cond;  /* the last worker finished the job */
+
+	/* the current job, under mutex */
+	worker_job job;
+	void * arg;
+	uint32_t count;
+	uint64_t generation; /* incremented with every job */
+	uint32_t pending; /* workers still running the job */
+	bool stop;
+};
+
+struct worker_start {
+	struct worker_pool * pool;
+	uint32_t index;
+};
+
+static void * worker_loop(void * p) {
+
+	struct worker_pool * pool = ((struct worker_start *)p)->pool;
+	uint32_t index = ((struct worker_start *)p)->index;
+	uint64_t generation = 0;
+
+	free(p);
+
+	pthread_mutex_lock(&pool->mutex);
+	while(true) {
+		while(!pool->stop && pool->generation == generation) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		}
+		if (pool->stop) break;
+		generation = pool->generation;
+		if (index >= pool->count) continue;
+
+		worker_job job = pool->job;
+		void * arg = pool->arg;
+		uint32_t count = pool->count;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job(arg, index, count);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->pending == 0) pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+struct worker_pool * worker_pool_create(uint32_t size) {
+
+	uint32_t i;
+	struct worker_pool * pool = calloc(1, sizeof(struct worker_pool));
+	if (!pool) return NULL;
+
+	pool->threads = calloc(size, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for(i = 0; i < size; i++) {
+		struct worker_start * start = malloc(sizeof(struct worker_start));
+		if (!start) break;
+		start->pool = pool;
+		start->index = i;
+		if (pthread_create(&pool->threads[i], NULL, worker_loop, start)) {
+			free(start);
+			break;
+		}
+	}
+	pool->size = i;
+	if (pool->size < size) {
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+uint32_t worker_pool_size(const struct worker_pool * pool) {
+
+	return pool->size;
+}
+
+void worker_pool_run(struct worker_pool * pool, uint32_t count, worker_job job, void * arg) {
+
+	if (count > pool->size) count = pool->size;
+	if (!count) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->job = job;
+	pool->arg = arg;
+	pool->count = count;
+	pool->pending = count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	while(pool->pending) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void worker_pool_destroy(struct worker_pool * pool) {
+
+	uint32_t i;
+
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(i = 0; i < pool->size; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,27 @@
+#ifndef workers_h
+#define workers_h
+
+#include <stdint.h>
+
+/* Fixed pool of worker threads, all running the same job at once.
+ *
+ * worker_pool_run() hands the job to the first 'count' workers, each called
+ * with its own index, and returns when all of them are done. The calling
+ * thread only waits, so the job must not depend on it.
+ */
+struct worker_pool;
+
+typedef void (*worker_job)(void * arg, uint32_t worker, uint32_t count);
+
+/* start 'size' threads, NULL on failure */
+struct worker_pool * worker_pool_create(uint32_t size);
+
+uint32_t worker_pool_size(const struct worker_pool * pool);
+
+/* run job(arg, i, count) on workers 0 to count-1 and wait for them */
+void worker_pool_run(struct worker_pool * pool, uint32_t count, worker_job job, void * arg);
+
+/* stop and join the threads */
+void worker_pool_destroy(struct worker_pool * pool);
+
+#endif
@@ -2,12 +2,16 @@
 #include "world.h"
 #include "scene.h"
 #include "input_callbacks.h"
-#include <sys/time.h>
+#include "timing.h"
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "models/plane.h"
 #include "models/terrain.h"
@@ -15,12 +19,14 @@
 #include "models/sphere.h"
 #include "printmath.h"
 
-const double tick_length = 0.05;
-
 const float move_rate = 10.0; // units per second
 const float rotate_rate = 25.0; // degrees per second
 
-#define IN_QUEUE_LEN 16
+/* capacity of the input event queue */
+#define IN_QUEUE_LEN 256
+#if IN_QUEUE_LEN & (IN_QUEUE_LEN - 1)
+#error IN_QUEUE_LEN must be a power of two
+#endif
 
 enum input_event_type {
 	EVENT_NONE,
@@ -39,13 +45,27 @@ struct input_event {
 	int keycode;
 };
 
-struct input_event in_queue[IN_QUEUE_LEN];
-int in_queue_head=0, in_queue_tail=0;
-pthread_mutex_t in_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t in_queue_event = PTHREAD_COND_INITIALIZER;
+enum in_slot_state {
+	IN_SLOT_TAKEN,   /* free, or claimed by the consumer */
+	IN_SLOT_READY,   /* queued */
+	IN_SLOT_WRITING, /* a queued mouse move being updated by the producer */
+};
 
-#define in_queue_empty() (in_queue_head == in_queue_tail)
-#define in_queue_full() (((in_queue_head + 1) % IN_QUEUE_LEN) == in_queue_tail)
+struct in_slot {
+	uint32_t state;
+	struct input_event event;
+};
+
+/* Lock-free single producer, single consumer ring: the platform event loop
+ * queues the events through the on_*() callbacks, the world thread takes them.
+ * head and tail are free-running, each written by one side only.
+ * A mouse move right after another one still queued replaces it, the slot
+ * state tells whether the consumer has claimed it already.
+ */
+static struct in_slot in_queue[IN_QUEUE_LEN];
+static uint32_t in_queue_head, in_queue_tail;
+/* futex word, 1 while the world thread sleeps waiting for events */
+static uint32_t in_queue_waiting;
 
 struct world {
 	struct scene * scene;
@@ -60,6 +80,7 @@ struct world {
 	double moving_forward, moving_back, moving_left, moving_right;
 	double turning_left, turning_right;
 
+	double tick_length; /* 1 / --tick-rate */
 	double last_tick, next_tick;
 
 	pthread_t thread;
@@ -67,64 +88,76 @@ struct world {
 	bool stop; /* request to stop the rendering thread */
 };
 
-static inline double get_time(void) {
-
-	struct timeval tv;
+static void in_queue_wake(void) {
 
-	gettimeofday(&tv, NULL);
-	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+	if (__atomic_exchange_n(&in_queue_waiting, 0, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &in_queue_waiting, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
 }
 
-void on_mouse_button_press(float x, float y, int button) {
+/* Queue the event, waiting for the world thread to make room when the queue is full */
+static void in_queue_push(const struct input_event * event) {
 
-	pthread_mutex_lock(&in_queue_mutex);
-	if (in_queue_full()) {
-		fprintf(stderr, "dropping mouse button press event\n");
+	uint32_t head = __atomic_load_n(&in_queue_head, __ATOMIC_RELAXED);
+
+	if (event->type == EVENT_MOUSE_MOVE && head != __atomic_load_n(&in_queue_tail, __ATOMIC_ACQUIRE)) {
+		struct in_slot * last = &in_queue[(head - 1) & (IN_QUEUE_LEN - 1)];
+		uint32_t expected = IN_SLOT_READY;
+		if (last->event.type == EVENT_MOUSE_MOVE
+				&& __atomic_compare_exchange_n(&last->state, &expected, IN_SLOT_WRITING,
+								false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			last->event = *event;
+			__atomic_store_n(&last->state, IN_SLOT_READY, __ATOMIC_RELEASE);
+			return;
+		}
 	}
-	else {
-		in_queue[in_queue_head].type = EVENT_MOUSE_BUTTON_PRESS;
-		in_queue[in_queue_head].timestamp = get_time();
-		in_queue[in_queue_head].x = x;
-		in_queue[in_queue_head].y = y;
-		in_queue[in_queue_head].buttons = button;
-		in_queue_head = (in_queue_head + 1) % IN_QUEUE_LEN;
-		pthread_cond_signal(&in_queue_event);
+
+	while (head - __atomic_load_n(&in_queue_tail, __ATOMIC_ACQUIRE) == IN_QUEUE_LEN) {
+		if (exit_requested()) return;
+		in_queue_wake();
+		sched_yield();
 	}
-	pthread_mutex_unlock(&in_queue_mutex);
+
+	struct in_slot * slot = &in_queue[head & (IN_QUEUE_LEN - 1)];
+	slot->event = *event;
+	__atomic_store_n(&slot->state, IN_SLOT_READY, __ATOMIC_RELAXED);
+	/* sequentially consistent with the consumer's in_queue_waiting store */
+	__atomic_store_n(&in_queue_head, head + 1, __ATOMIC_SEQ_CST);
+	in_queue_wake();
+}
+
+void on_mouse_button_press(float x, float y, int button) {
+
+	struct input_event event = {
+		.type = EVENT_MOUSE_BUTTON_PRESS,
+		.timestamp = timing_now(),
+		.x = x,
+		.y = y,
+		.buttons = button,
+	};
+	in_queue_push(&event);
 }
 void on_mouse_button_release(float x, float y, int button) {
 
-	pthread_mutex_lock(&in_queue_mutex);
-	if (in_queue_full()) {
-		fprintf(stderr, "dropping mouse button release event\n");
-	}
-	else {
-		in_queue[in_queue_head].type = EVENT_MOUSE_BUTTON_RELEASE;
-		in_queue[in_queue_head].timestamp = get_time();
-		in_queue[in_queue_head].x = x;
-		in_queue[in_queue_head].y = y;
-		in_queue[in_queue_head].buttons = button;
-		in_queue_head = (in_queue_head + 1) % IN_QUEUE_LEN;
-		pthread_cond_signal(&in_queue_event);
-	}
-	pthread_mutex_unlock(&in_queue_mutex);
+	struct input_event event = {
+		.type = EVENT_MOUSE_BUTTON_RELEASE,
+		.timestamp = timing_now(),
+		.x = x,
+		.y = y,
+		.buttons = button,
+	};
+	in_queue_push(&event);
 }
 void on_mouse_move(float x, float y, int buttons) {
 
-	pthread_mutex_lock(&in_queue_mutex);
-	if (in_queue_full()) {
-		fprintf(stderr, "dropping mouse move event\n");
-	}
-	else {
-		in_queue[in_queue_head].type = EVENT_MOUSE_MOVE;
-		in_queue[in_queue_head].timestamp = get_time();
-		in_queue[in_queue_head].x = x;
-		in_queue[in_queue_head].y = y;
-		in_queue[in_queue_head].buttons = buttons;
-		in_queue_head = (in_queue_head + 1) % IN_QUEUE_LEN;
-		pthread_cond_signal(&in_queue_event);
-	}
-	pthread_mutex_unlock(&in_queue_mutex);
+	struct input_event event = {
+		.type = EVENT_MOUSE_MOVE,
+		.timestamp = timing_now(),
+		.x = x,
+		.y = y,
+		.buttons = buttons,
+	};
+	in_queue_push(&event);
 }
 
 void on_key_press(int keycode) {
@@ -135,37 +168,24 @@ void on_key_press(int keycode) {
 	else if (keycode == KEY_NONE) {
 		return;
 	}
-	pthread_mutex_lock(&in_queue_mutex);
-	if (in_queue_full()) {
-		fprintf(stderr, "dropping key press event\n");
-	}
-	else {
-		in_queue[in_queue_head].type = EVENT_KEY_PRESS;
-		in_queue[in_queue_head].timestamp = get_time();
-		in_queue[in_queue_head].keycode = keycode;
-		in_queue_head = (in_queue_head + 1) % IN_QUEUE_LEN;
-		pthread_cond_signal(&in_queue_event);
-	}
-	pthread_mutex_unlock(&in_queue_mutex);
-
+	struct input_event event = {
+		.type = EVENT_KEY_PRESS,
+		.timestamp = timing_now(),
+		.keycode = keycode,
+	};
+	in_queue_push(&event);
 }
 void on_key_release(int keycode) {
 
 	if (keycode == KEY_NONE) {
 		return;
 	}
-	pthread_mutex_lock(&in_queue_mutex);
-	if (in_queue_full()) {
-		fprintf(stderr, "dropping key release event\n");
-	}
-	else {
-		in_queue[in_queue_head].type = EVENT_KEY_RELEASE;
-		in_queue[in_queue_head].timestamp = get_time();
-		in_queue[in_queue_head].keycode = keycode;
-		in_queue_head = (in_queue_head + 1) % IN_QUEUE_LEN;
-		pthread_cond_signal(&in_queue_event);
-	}
-	pthread_mutex_unlock(&in_queue_mutex);
+	struct input_event event = {
+		.type = EVENT_KEY_RELEASE,
+		.timestamp = timing_now(),
+		.keycode = keycode,
+	};
+	in_queue_push(&event);
 }
 
 static Vec3 make_direction_vector(float x_angle) {
@@ -176,37 +196,38 @@ static Vec3 make_direction_vector(float x_angle) {
 	return result;
 }
 
+/* Take the next queued event, sleeping until 'deadline' (timing_now() seconds) for one */
 bool get_in_queue_event(struct input_event *event_p, double deadline) {
 
-	bool got_event = false;
-	struct timespec ts = {0};
-	int r;
-
-	if (deadline > 0) {
-		ts.tv_sec = (time_t) deadline;
-		ts.tv_nsec = (long) fmod(deadline, 1) * 1000000000;
-	}
-
-	pthread_mutex_lock(&in_queue_mutex);
-	if (!in_queue_empty()) {
-		got_event = true;
-	}
-	else {
-		r = pthread_cond_timedwait(&in_queue_event, &in_queue_mutex, &ts);
-		if (r == 0) {
-			got_event = true;
-		}
-		else if (r && r!= ETIMEDOUT) {
-			fprintf(stderr, "unexpected pthread_cond_timedwait() result: %i\n", r);
-			request_exit();
+	uint32_t tail = __atomic_load_n(&in_queue_tail, __ATOMIC_RELAXED);
+
+	if (__atomic_load_n(&in_queue_head, __ATOMIC_ACQUIRE) == tail) {
+		/* announce the sleep before the last check, the producer only wakes a sleeper */
+		__atomic_store_n(&in_queue_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&in_queue_head, __ATOMIC_SEQ_CST) == tail) {
+			/* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+			struct timespec ts = timing_timespec(deadline);
+			long r = syscall(SYS_futex, &in_queue_waiting, FUTEX_WAIT_BITSET_PRIVATE,
+						1, &ts, NULL, FUTEX_BITSET_MATCH_ANY);
+			if (r && errno != ETIMEDOUT && errno != EAGAIN && errno != EINTR) {
+				fprintf(stderr, "unexpected futex() error: %s\n", strerror(errno));
+				request_exit();
+			}
 		}
+		__atomic_store_n(&in_queue_waiting, 0, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&in_queue_head, __ATOMIC_ACQUIRE) == tail) return false;
 	}
-	if (got_event) {
-		*event_p = in_queue[in_queue_tail];
-		in_queue_tail = (in_queue_tail + 1) % IN_QUEUE_LEN;
+
+	struct in_slot * slot = &in_queue[tail & (IN_QUEUE_LEN - 1)];
+	uint32_t expected = IN_SLOT_READY;
+	/* the producer may be updating a mouse move, only for a moment */
+	while (!__atomic_compare_exchange_n(&slot->state, &expected, IN_SLOT_TAKEN,
+						false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		expected = IN_SLOT_READY;
 	}
-	pthread_mutex_unlock(&in_queue_mutex);
-	return got_event;
+	*event_p = slot->event;
+	__atomic_store_n(&in_queue_tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
 }
 
 void world_process_key_event(struct world * world, struct input_event event) {
@@ -294,14 +315,11 @@ void * world_loop(void * arg) {
 
 	struct world * world = (struct world *) arg;
 
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-
-	double now = get_time();
+	double now = timing_now();
 	world->last_tick = now;
+	world->next_tick = now + world->tick_length;
 
 	while(!exit_requested()) {
-		world->next_tick = world->last_tick + tick_length;
 		pthread_mutex_lock(&world->mutex);
 		bool stop = world->stop;
 		pthread_mutex_unlock(&world->mutex);
@@ -323,7 +341,7 @@ void * world_loop(void * arg) {
 						break;
 				}
 			}
-			now = get_time();
+			now = timing_now();
 		} while(now <= world->next_tick);
 
 		world_continue_movement(world, now);
@@ -342,9 +360,13 @@ void * world_loop(void * arg) {
 		world->ch_direction += world->ch_rotation;
 
 		// update scene eye
-		scene_set_eye(world->scene, world->ch_position, make_direction_vector(world->ch_direction));
+		scene_set_eye(world->scene, world->ch_position, make_direction_vector(world->ch_direction), now);
 
 		world->last_tick = now;
+
+		/* fixed deadlines, the wakeup latencies do not add up */
+		world->next_tick += world->tick_length;
+		if (world->next_tick < now) world->next_tick = now + world->tick_length;
 	}
 
 	return NULL;
@@ -360,10 +382,11 @@ struct world * create_world(void) {
 	pthread_mutex_init(&world->mutex, NULL);
 
 	world->ch_direction = initial_direction;
+	world->tick_length = 1.0 / options.tick_rate;
 
 	world->scene = create_scene();
 
-	world->terrain = create_terrain(256, 256, "assets/heightmap.data", 32);
+	world->terrain = create_terrain(256, 256, "assets/heightmap.data", 32, options.shared_terrain);
 
 	world->ch_position = initial_position;
 	world->ch_position.y = sample_terrain_height(world->terrain, world->ch_position.x, world->ch_position.z) + 2.0f;
@@ -390,7 +413,10 @@ struct world * create_world(void) {
 	Mat4 mat = mat4_translate(0.0f, 0.5f + sample_terrain_height(world->terrain, 0.0f, 2.0f), 2.0f);
 	scene_add_object(world->scene, sphere, mat);
 
-	scene_set_eye(world->scene, world->ch_position, make_direction_vector(world->ch_direction));
+	/* twice, no movement to interpolate from the scene's default view */
+	double now = timing_now();
+	scene_set_eye(world->scene, world->ch_position, make_direction_vector(world->ch_direction), now);
+	scene_set_eye(world->scene, world->ch_position, make_direction_vector(world->ch_direction), now);
 
 	return world;
 }